@@ -0,0 +1,193 @@
+// Times forward & backward over long chains of Values and Tensors, and
+// over a square matmul with each GEMM kernel the CPU supports, and over a
+// bias + activation chain run eagerly and fused.
+//
+//   ./backward_benchmark [chain_length]   (default: 1000000)
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "buffer_cache.h"
+#include "fusion.h"
+#include "gemm.h"
+#include "tensor.h"
+#include "value.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+static void bench_value_chain(int n) {
+  auto start = Clock::now();
+  std::shared_ptr<Value> x = std::make_shared<Value>(1.0);
+  std::shared_ptr<Value> out = x;
+  for (int i = 0; i < n; i++) {
+    out = out->add(x);
+  }
+  double forward_ms = ms_since(start);
+
+  start = Clock::now();
+  out->backward();
+  double backward_ms = ms_since(start);
+
+  std::printf(
+      "value  chain %9d | forward %9.2f ms | backward %9.2f ms | grad %.0f\n",
+      n,
+      forward_ms,
+      backward_ms,
+      x->grad);
+}
+
+// forward only, then drop the graph (like an evaluation pass)
+static void bench_value_teardown(int n) {
+  std::shared_ptr<Value> x = std::make_shared<Value>(1.0);
+  std::shared_ptr<Value> out = x;
+  for (int i = 0; i < n; i++) {
+    out = out->add(x);
+  }
+
+  auto start = Clock::now();
+  out.reset();
+  double teardown_ms = ms_since(start);
+
+  std::printf("value  chain %9d | teardown %8.2f ms\n", n, teardown_ms);
+}
+
+static void bench_tensor_chain(int n) {
+  auto start = Clock::now();
+  std::shared_ptr<Tensor> x = std::make_shared<Tensor>(std::vector<int>{1});
+  x->data[0] = 1.0;
+  x->requires_grad = true;
+  std::shared_ptr<Tensor> out = x;
+  for (int i = 0; i < n; i++) {
+    out = out->add(x);
+  }
+  double forward_ms = ms_since(start);
+
+  start = Clock::now();
+  out->backward();
+  double backward_ms = ms_since(start);
+
+  std::printf(
+      "tensor chain %9d | forward %9.2f ms | backward %9.2f ms | grad %.0f\n",
+      n,
+      forward_ms,
+      backward_ms,
+      x->grad[0]);
+}
+
+static void bench_matmul(int size) {
+  std::string original = gemm_kernel();
+  for (std::string kernel : {"generic", "avx2", "avx512"}) {
+    if (!set_gemm_kernel(kernel)) {
+      continue;
+    }
+    std::vector<int> shape = {size, size};
+    std::shared_ptr<Tensor> a = std::make_shared<Tensor>(shape);
+    std::shared_ptr<Tensor> b = std::make_shared<Tensor>(shape);
+    for (int i = 0; i < size * size; i++) {
+      a->data[i] = (i % 7) * 0.1;
+      b->data[i] = (i % 5) * 0.2;
+    }
+    a->requires_grad = true;
+    b->requires_grad = true;
+
+    auto start = Clock::now();
+    std::shared_ptr<Tensor> out = a->matmul(b);
+    double forward_ms = ms_since(start);
+
+    start = Clock::now();
+    out->backward();
+    double backward_ms = ms_since(start);
+
+    std::printf(
+        "matmul %4dx%-4d %-7s | forward %9.2f ms | backward %9.2f ms\n",
+        size,
+        size,
+        kernel.c_str(),
+        forward_ms,
+        backward_ms);
+  }
+  set_gemm_kernel(original);
+}
+
+static void bench_activation_chain(int rows, int cols) {
+  for (bool fused : {false, true}) {
+    std::shared_ptr<Tensor> x =
+        std::make_shared<Tensor>(std::vector<int>{rows, cols});
+    std::shared_ptr<Tensor> bias =
+        std::make_shared<Tensor>(std::vector<int>{cols});
+    for (size_t i = 0; i < x->data.size(); i++) {
+      x->data[i] = (i % 11) * 0.1 - 0.5;
+    }
+    x->requires_grad = true;
+    bias->requires_grad = true;
+
+    auto start = Clock::now();
+    std::shared_ptr<Tensor> out = fused
+        ? x->lazy()->add(bias)->gelu()->mul(x)->tanh()->materialize()
+        : x->add(bias)->gelu()->mul(x)->tanh();
+    double forward_ms = ms_since(start);
+
+    start = Clock::now();
+    out->backward();
+    double backward_ms = ms_since(start);
+
+    std::printf(
+        "chain  %4dx%-4d %-7s | forward %9.2f ms | backward %9.2f ms\n",
+        rows,
+        cols,
+        fused ? "fused" : "eager",
+        forward_ms,
+        backward_ms);
+  }
+}
+
+// steady state of a training loop: the same forward & backward, step after
+// step, with the buffer cache on and off
+static void bench_buffer_cache(int rows, int cols, int steps) {
+  BufferCache& cache = BufferCache::global();
+  for (bool cached : {false, true}) {
+    cache.set_limit(cached ? BufferCache::kDefaultLimit : 0);
+    cache.reset_stats();
+    std::shared_ptr<Tensor> x =
+        std::make_shared<Tensor>(std::vector<int>{rows, cols});
+    std::shared_ptr<Tensor> bias =
+        std::make_shared<Tensor>(std::vector<int>{cols});
+    bias->requires_grad = true;
+
+    auto start = Clock::now();
+    for (int step = 0; step < steps; step++) {
+      std::shared_ptr<Tensor> out =
+          x->add(bias)->relu()->mul(x)->sigmoid()->sum({1});
+      out->backward();
+    }
+    double step_ms = ms_since(start) / steps;
+
+    BufferCache::Stats stats = cache.stats();
+    std::printf(
+        "steps  %4dx%-4d %-7s | step    %9.2f ms | hits %zu, misses %zu\n",
+        rows,
+        cols,
+        cached ? "cached" : "malloc",
+        step_ms,
+        stats.hits,
+        stats.misses);
+  }
+}
+
+int main(int argc, char** argv) {
+  int n = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  bench_value_chain(n);
+  bench_value_teardown(n);
+  bench_tensor_chain(n);
+  bench_matmul(512);
+  bench_activation_chain(1024, 1024);
+  bench_buffer_cache(1024, 1024, 20);
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include "arena.h"
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+static size_t align_up(size_t n, size_t align) {
+  return (n + align - 1) & ~(align - 1);
+}
+
+size_t Arena::payload_start() {
+  return align_up(sizeof(Chunk), alignof(std::max_align_t));
+}
+
+Arena& Arena::current() {
+  // never destroyed, so nodes outliving their thread can still be freed.
+  // Listed in `all`, so the arena of a thread that exited (a pool worker
+  // that made nodes, say) isn't lost along with its thread.
+  static thread_local Arena* arena = [] {
+    static std::mutex mutex;
+    static std::vector<Arena*>* all = new std::vector<Arena*>();
+    Arena* a = new Arena();
+    std::lock_guard<std::mutex> lock(mutex);
+    all->push_back(a);
+    return a;
+  }();
+  return *arena;
+}
+
+Arena::Chunk* Arena::next_chunk() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (this->current_ != nullptr) {
+    this->current_->retired = true;
+    if (this->current_->live == 0) {
+      this->current_->in_free_list = true;
+      this->free_list_.push_back(this->current_);
+    }
+  }
+
+  Chunk* chunk = nullptr;
+  if (!this->free_list_.empty()) {
+    chunk = this->free_list_.back();
+    this->free_list_.pop_back();
+    chunk->retired = false;
+    chunk->in_free_list = false;
+  } else {
+    void* mem = std::aligned_alloc(kChunkSize, kChunkSize);
+    if (mem == nullptr) {
+      throw std::bad_alloc();
+    }
+    chunk = new (mem) Chunk();
+    chunk->arena = this;
+    this->chunk_count_++;
+  }
+  chunk->offset = payload_start();
+  return chunk;
+}
+
+void* Arena::allocate(size_t bytes, size_t align) {
+  if (bytes + payload_start() > kChunkSize) {
+    return ::operator new(bytes);
+  }
+  if (this->current_ == nullptr) {
+    this->current_ = this->next_chunk();
+  }
+  size_t offset = align_up(this->current_->offset, align);
+  if (offset + bytes > kChunkSize) {
+    this->current_ = this->next_chunk();
+    offset = align_up(this->current_->offset, align);
+  }
+  this->current_->offset = offset + bytes;
+  this->current_->live++;
+  return reinterpret_cast<char*>(this->current_) + offset;
+}
+
+void Arena::deallocate(void* p, size_t bytes) noexcept {
+  if (bytes + payload_start() > kChunkSize) {
+    ::operator delete(p);
+    return;
+  }
+  Chunk* chunk = reinterpret_cast<Chunk*>(
+      reinterpret_cast<uintptr_t>(p) & ~uintptr_t(kChunkSize - 1));
+  if (chunk->live.fetch_sub(1) != 1) {
+    return;
+  }
+
+  // last node of a filled chunk: the whole chunk can be reused
+  Arena* arena = chunk->arena;
+  std::lock_guard<std::mutex> lock(arena->mutex_);
+  if (chunk->retired && !chunk->in_free_list && chunk->live == 0) {
+    chunk->in_free_list = true;
+    arena->free_list_.push_back(chunk);
+  }
+}
+
+bool Arena::reset() {
+  if (this->current_ == nullptr) {
+    return true; // nothing allocated yet
+  }
+  if (this->current_->live != 0) {
+    return false;
+  }
+  this->current_->offset = payload_start();
+  return true;
+}
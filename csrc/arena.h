@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/// Arena
+/// Bump allocator for the intermediate (non-leaf) nodes of the autograd
+/// graph. Every op of a forward pass allocates its output node (and the
+/// shared_ptr control block) by bumping a pointer into the current chunk,
+/// instead of going through malloc.
+///
+/// Chunks are `kChunkSize` bytes and aligned to their size, so a node finds
+/// its chunk by masking its own address. Each chunk counts its live nodes:
+/// - `reset()` rewinds the current chunk in O(1) once all of its nodes are
+///   gone (the optimizer calls it after each step).
+/// - a filled chunk whose nodes are all gone goes back to a free list and is
+///   reused by the next forward pass.
+/// So a node kept across steps (like a logged loss) only pins its own chunk.
+///
+/// Parameters and user-created leaves don't go through the arena.
+class Arena {
+public:
+  static constexpr size_t kChunkSize = size_t(1) << 18; // 256 KiB
+
+private:
+  struct Chunk {
+    Arena* arena;
+    std::atomic<size_t> live{0}; // nodes allocated from this chunk, not freed
+    size_t offset = 0; // bump pointer, relative to the chunk start
+    bool retired = false; // no longer the current chunk
+    bool in_free_list = false;
+  };
+
+  static size_t payload_start();
+
+  Chunk* current_ = nullptr;
+  std::vector<Chunk*> free_list_;
+  size_t chunk_count_ = 0;
+  std::mutex mutex_; // guards `free_list_` and the `retired` flags
+
+  Chunk* next_chunk();
+
+public:
+  static Arena& current();
+
+  void* allocate(size_t bytes, size_t align);
+  static void deallocate(void* p, size_t bytes) noexcept;
+
+  // rewind the current chunk if none of its nodes are alive. Returns whether
+  // it did.
+  bool reset();
+
+  // chunks owned by the arena (they are never handed back to the OS)
+  size_t chunk_count() {
+    return this->chunk_count_;
+  }
+
+  // nodes of the current chunk that are still alive
+  size_t live() {
+    return this->current_ == nullptr ? 0 : this->current_->live.load();
+  }
+};
+
+template <class T>
+struct ArenaAllocator {
+  using value_type = T;
+
+  Arena* arena;
+
+  explicit ArenaAllocator(Arena* arena) noexcept : arena(arena) {}
+
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+      : arena(other.arena) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(this->arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    Arena::deallocate(p, n * sizeof(T));
+  }
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena == b.arena;
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena != b.arena;
+}
+
+// make_shared for graph nodes: object and control block live in the arena of
+// the current thread
+template <class T, class... Args>
+std::shared_ptr<T> make_node(Args&&... args) {
+  return std::allocate_shared<T>(
+      ArenaAllocator<T>(&Arena::current()), std::forward<Args>(args)...);
+}
@@ -0,0 +1,119 @@
+#include "buffer_cache.h"
+#include <utility>
+
+namespace {
+
+constexpr size_t kGrain = 64; // elements of the small classes, 512 bytes
+constexpr size_t kSmall = 16; // classes of kGrain steps, up to 1024
+
+// the smallest class holding `n` elements
+size_t class_of(size_t n) {
+  if (n <= kSmall * kGrain) {
+    return n == 0 ? 0 : (n - 1) / kGrain;
+  }
+  // 2^(k+1) < n <= 2^(k+2), split in four steps of 2^(k-1)
+  size_t k = 9;
+  while (k < 60 && (size_t(4) << k) < n) {
+    k++;
+  }
+  size_t step = size_t(1) << (k - 1);
+  size_t steps = (n + step - 1) / step; // 5 to 8
+  return kSmall + (k - 9) * 4 + (steps - 5);
+}
+
+// elements in a buffer of class `c`
+size_t size_of(size_t c) {
+  if (c < kSmall) {
+    return (c + 1) * kGrain;
+  }
+  size_t k = 9 + (c - kSmall) / 4;
+  return (size_t(1) << (k - 1)) * (5 + (c - kSmall) % 4);
+}
+
+size_t bytes_of(size_t c) {
+  return size_of(c) * sizeof(double);
+}
+
+} // namespace
+
+BufferCache& BufferCache::global() {
+  static BufferCache* cache = new BufferCache();
+  return *cache;
+}
+
+std::shared_ptr<BufferCache::Buffer> BufferCache::acquire(size_t n) {
+  auto recycle = [this](Buffer* buffer) { this->recycle(buffer); };
+  size_t c = class_of(n);
+  if (c >= kClasses) {
+    // too big for a class, never cached
+    return std::shared_ptr<Buffer>(new Buffer(n));
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    std::vector<std::unique_ptr<Buffer>>& free = this->free_[c];
+    if (!free.empty()) {
+      Buffer* buffer = free.back().release();
+      free.pop_back();
+      this->stats_.hits++;
+      this->stats_.bytes_cached -= bytes_of(c);
+      this->stats_.buffers_cached--;
+      return std::shared_ptr<Buffer>(buffer, recycle);
+    }
+    this->stats_.misses++;
+  }
+  // outside the lock
+  return std::shared_ptr<Buffer>(new Buffer(size_of(c)), recycle);
+}
+
+void BufferCache::recycle(Buffer* buffer) noexcept {
+  size_t c = class_of(buffer->size());
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (this->stats_.bytes_cached + bytes_of(c) <= this->limit_) {
+      this->free_[c].emplace_back(buffer);
+      this->stats_.bytes_cached += bytes_of(c);
+      this->stats_.buffers_cached++;
+      return;
+    }
+  }
+  delete buffer;
+}
+
+void BufferCache::empty() {
+  this->trim(0);
+}
+
+BufferCache::Stats BufferCache::stats() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  return this->stats_;
+}
+
+void BufferCache::reset_stats() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->stats_.hits = 0;
+  this->stats_.misses = 0;
+}
+
+void BufferCache::set_limit(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->limit_ = bytes;
+  }
+  this->trim(bytes);
+}
+
+void BufferCache::trim(size_t bytes) {
+  // freed outside the lock
+  std::vector<std::unique_ptr<Buffer>> evicted;
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  // biggest buffers first
+  for (size_t c = kClasses; c-- > 0 && this->stats_.bytes_cached > bytes;) {
+    std::vector<std::unique_ptr<Buffer>>& free = this->free_[c];
+    while (!free.empty() && this->stats_.bytes_cached > bytes) {
+      evicted.push_back(std::move(free.back()));
+      free.pop_back();
+      this->stats_.bytes_cached -= bytes_of(c);
+      this->stats_.buffers_cached--;
+    }
+  }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// BufferCache
+/// Caching allocator for the buffers behind Storage. A training step
+/// allocates the same output shapes as the step before, so instead of going
+/// back to malloc (and, for big buffers, to fresh pages from the OS) a freed
+/// buffer is kept and handed to the next request of its size class.
+///
+/// Size classes are multiples of 64 elements (512 bytes) up to 1024
+/// elements, then four per power of two, each at most 1.25x the one below:
+/// a request gets the smallest class that holds it (Storage keeps its own
+/// size), so at most a quarter of a big buffer goes unused. Buffers are not
+/// initialized, whoever needs zeros writes them. At most `limit` bytes stay
+/// cached; past that, freed buffers go back to malloc. Safe to use from any
+/// thread.
+class BufferCache {
+public:
+  // `size` elements, left uninitialized
+  class Buffer {
+  private:
+    std::unique_ptr<double[]> data_;
+    size_t size_;
+
+  public:
+    explicit Buffer(size_t size) : data_(new double[size]), size_(size) {}
+
+    double* data() {
+      return this->data_.get();
+    }
+
+    size_t size() const {
+      return this->size_;
+    }
+  };
+
+  struct Stats {
+    size_t hits = 0; // requests served from the cache
+    size_t misses = 0; // requests that allocated
+    size_t bytes_cached = 0; // in free buffers, waiting for reuse
+    size_t buffers_cached = 0;
+  };
+
+  static constexpr size_t kDefaultLimit = size_t(1) << 30; // 1 GiB
+
+private:
+  // 16 classes up to 1024 elements, then 4 per power of two up to 2^47
+  static constexpr size_t kClasses = 16 + 4 * 37;
+
+  std::mutex mutex_; // guards everything below
+  std::vector<std::unique_ptr<Buffer>> free_[kClasses];
+  Stats stats_;
+  size_t limit_ = kDefaultLimit;
+
+  // back to the cache (or to malloc), when the last Storage lets go of it
+  void recycle(Buffer* buffer) noexcept;
+
+  // frees cached buffers, biggest first, until at most `bytes` are left
+  void trim(size_t bytes);
+
+public:
+  // the cache Storage allocates from. Never destroyed, so buffers freed
+  // during exit still have somewhere to go.
+  static BufferCache& global();
+
+  // a buffer of at least `n` elements, their values unspecified
+  std::shared_ptr<Buffer> acquire(size_t n);
+
+  // frees the cached buffers (the ones in use are not affected)
+  void empty();
+
+  Stats stats();
+  void reset_stats();
+
+  // bytes kept at most, 0 turns caching off. Frees what's over.
+  void set_limit(size_t bytes);
+};
@@ -0,0 +1,113 @@
+#include "capture.h"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "grad_mode.h"
+
+namespace {
+
+// every tensor reachable from `root`, inputs first. Unlike the backward
+// pass, this keeps the ones that don't require grad: their forward closures
+// are part of the step.
+std::vector<Tensor*> capture_order(Tensor* root) {
+  std::vector<Tensor*> order;
+  std::unordered_set<Tensor*> visited = {root};
+  // (tensor, index of the next input to visit)
+  std::vector<std::pair<Tensor*, size_t>> stack = {{root, 0}};
+  while (!stack.empty()) {
+    auto& [t, next_input] = stack.back();
+    if (next_input < t->_prev.size()) {
+      Tensor* input = t->_prev[next_input++].get();
+      if (visited.insert(input).second) {
+        stack.emplace_back(input, 0);
+      }
+      continue;
+    }
+    order.push_back(t);
+    stack.pop_back();
+  }
+  return order;
+}
+
+} // namespace
+
+CapturedStep::CapturedStep(
+    const std::shared_ptr<Model>& model,
+    std::shared_ptr<Tensor> input,
+    std::shared_ptr<Tensor> target,
+    const LossFn& loss_fn)
+    : input_(std::move(input)), target_(std::move(target)) {
+  if (!GradMode::is_enabled()) {
+    throw std::runtime_error(
+        "CapturedStep: can't capture a step while grad mode is disabled.");
+  }
+
+  std::shared_ptr<Value> loss;
+  {
+    CaptureGraphGuard capture;
+    this->output_ = model->call(this->input_);
+    loss = loss_fn(this->output_, this->target_);
+  }
+
+  // the loss has to be the output of a tensor-op, not of scalar Value ops
+  this->loss_ = loss->tensor();
+  if (this->loss_ == nullptr || this->loss_->is_leaf()) {
+    throw std::runtime_error(
+        "CapturedStep: the loss function must return the Value of a tensor "
+        "loss (like mean_squared_error).");
+  }
+
+  this->order_ = capture_order(this->loss_.get());
+  this->run_backward();
+}
+
+void CapturedStep::run_backward() {
+  // same seeding as Tensor::backward: leaves accumulate, intermediate
+  // tensors start from zero. After the first step the buffers already have
+  // the right size, so nothing is allocated. Tensors that don't require
+  // grad are only replayed forward.
+  for (Tensor* t : this->order_) {
+    if (!t->requires_grad) {
+      continue;
+    }
+    if (t->is_leaf()) {
+      t->grad.resize(t->numel(), 0.0);
+    } else {
+      t->grad.assign(t->numel(), 0.0);
+    }
+  }
+  this->loss_->grad[0] = 1.0;
+
+  for (auto it = this->order_.rbegin(); it != this->order_.rend(); ++it) {
+    (*it)->executeBackWardMethod();
+  }
+}
+
+double CapturedStep::replay() {
+  for (Tensor* t : this->order_) {
+    t->executeForwardMethod();
+  }
+  this->run_backward();
+  return this->loss_->data[0];
+}
+
+double CapturedStep::replay(
+    const std::vector<double>& input,
+    const std::vector<double>& target) {
+  if (input.size() != this->input_->data.size() ||
+      target.size() != this->target_->data.size()) {
+    throw std::runtime_error(
+        "CapturedStep: replay expects " +
+        std::to_string(this->input_->data.size()) + " input and " +
+        std::to_string(this->target_->data.size()) +
+        " target elements. Got " + std::to_string(input.size()) + " and " +
+        std::to_string(target.size()) + ".");
+  }
+  std::copy(input.begin(), input.end(), this->input_->data.begin());
+  std::copy(target.begin(), target.end(), this->target_->data.begin());
+  return this->replay();
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <vector>
+#include "neural_network.h"
+#include "tensor.h"
+#include "value.h"
+
+/// CapturedStep
+/// Records one forward + loss + backward of a model on fixed shapes, and
+/// replays it on new data without building a new graph. Every op of the
+/// captured graph keeps its forward closure, and every tensor keeps its data
+/// and grad buffers, so a replay is: copy the new input & target in, rerun
+/// the forward closures in topological order, rerun the backward closures in
+/// reverse. Nothing is allocated.
+///
+/// The model's parameters are read live, so an optimizer can step between
+/// replays. Non-tensor arguments of the loss (like `actualIdx` of
+/// cross_entropy) are fixed at capture time.
+///
+///   CapturedStep step(model, input, target, mean_squared_error);
+///   for (...) {
+///     opt.zero_grad();
+///     double loss = step.replay(new_input, new_target);
+///     opt.step();
+///   }
+class CapturedStep {
+public:
+  using LossFn = std::function<std::shared_ptr<Value>(
+      std::shared_ptr<Tensor>,
+      std::shared_ptr<Tensor>)>;
+
+private:
+  std::shared_ptr<Tensor> input_;
+  std::shared_ptr<Tensor> target_;
+  std::shared_ptr<Tensor> output_;
+  std::shared_ptr<Tensor> loss_;
+  std::vector<Tensor*> order_; // topological order, inputs first
+
+  void run_backward();
+
+public:
+  // runs the first step (forward & backward) while capturing it
+  CapturedStep(
+      const std::shared_ptr<Model>& model,
+      std::shared_ptr<Tensor> input,
+      std::shared_ptr<Tensor> target,
+      const LossFn& loss_fn);
+
+  // rerun with the data currently in `input()` and `target()`. Returns the
+  // loss; the gradients are accumulated into the parameters.
+  double replay();
+
+  // copy new data into the input & target buffers, then rerun
+  double replay(
+      const std::vector<double>& input,
+      const std::vector<double>& target);
+
+  std::shared_ptr<Tensor> input() {
+    return this->input_;
+  }
+
+  std::shared_ptr<Tensor> target() {
+    return this->target_;
+  }
+
+  std::shared_ptr<Tensor> output() {
+    return this->output_;
+  }
+
+  double loss() {
+    return this->loss_->data[0];
+  }
+
+  // no. of tensors in the captured graph
+  size_t size() {
+    return this->order_.size();
+  }
+};
@@ -0,0 +1,317 @@
+#include "fusion.h"
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include "arena.h"
+#include "thread_pool.h"
+#include "vmath.h"
+
+namespace {
+
+// elements a thread takes, as for the eager elementwise ops
+constexpr size_t kFusedGrain = 1 << 14;
+
+// elements a tile: the values of a tile at every op stay in L1
+constexpr size_t kTile = 256;
+
+using Op = LazyTensor::Op;
+
+// an op as the fused closures see it (the node's _prev owns the operand)
+struct Step {
+  Op op;
+  double alpha;
+  Tensor* operand;
+};
+
+// out[j] = op(in[j]), for the elements [first, first + len) of the chain.
+// `out` may be `in`.
+void apply(
+    const Step& s,
+    const double* in,
+    double* out,
+    size_t first,
+    size_t len) {
+  switch (s.op) {
+    case Op::Relu:
+      for (size_t j = 0; j < len; j++) {
+        out[j] = in[j] < 0 ? 0 : in[j];
+      }
+      break;
+    case Op::Tanh:
+      vtanh(in, out, len);
+      break;
+    case Op::Gelu:
+      vgelu(in, out, nullptr, len);
+      break;
+    case Op::Sigmoid:
+      vsigmoid(in, out, len);
+      break;
+    case Op::LeakyRelu:
+      for (size_t j = 0; j < len; j++) {
+        out[j] = in[j] > 0 ? in[j] : s.alpha * in[j];
+      }
+      break;
+    case Op::Add:
+    case Op::Mul: {
+      // the operand repeats every `nb` elements (nb == numel: no broadcast)
+      const double* b = s.operand->data.data();
+      size_t nb = s.operand->numel();
+      size_t p = first % nb;
+      for (size_t j = 0; j < len; j++) {
+        out[j] = s.op == Op::Add ? in[j] + b[p] : in[j] * b[p];
+        p = p + 1 == nb ? 0 : p + 1;
+      }
+      break;
+    }
+  }
+}
+
+// turns g (the grad of `out`) into the grad of `in`, and adds the grad of
+// the operand to `operand_grad` (if not null, indexed like the operand)
+void backprop(
+    const Step& s,
+    const double* in,
+    const double* out,
+    double* g,
+    size_t first,
+    size_t len,
+    double* operand_grad) {
+  switch (s.op) {
+    case Op::Relu:
+      for (size_t j = 0; j < len; j++) {
+        g[j] *= out[j] > 0 ? 1.0 : 0.0;
+      }
+      break;
+    case Op::Tanh:
+      for (size_t j = 0; j < len; j++) {
+        g[j] *= 1.0 - out[j] * out[j];
+      }
+      break;
+    case Op::Gelu: {
+      // the tanh the recomputed forward didn't keep, then the grad of the
+      // tile into dx
+      double t[kTile];
+      double dx[kTile] = {};
+      double unused[kTile];
+      vgelu(in, unused, t, len);
+      gelu_backward(in, t, g, dx, len);
+      std::copy(dx, dx + len, g);
+      break;
+    }
+    case Op::Sigmoid:
+      for (size_t j = 0; j < len; j++) {
+        g[j] *= out[j] * (1.0 - out[j]);
+      }
+      break;
+    case Op::LeakyRelu:
+      for (size_t j = 0; j < len; j++) {
+        g[j] *= in[j] > 0 ? 1.0 : s.alpha;
+      }
+      break;
+    case Op::Add:
+    case Op::Mul: {
+      const double* b = s.operand->data.data();
+      size_t nb = s.operand->numel();
+      size_t p = first % nb;
+      for (size_t j = 0; j < len; j++) {
+        if (operand_grad != nullptr) {
+          operand_grad[p] += s.op == Op::Add ? g[j] : g[j] * in[j];
+        }
+        if (s.op == Op::Mul) {
+          g[j] *= b[p];
+        }
+        p = p + 1 == nb ? 0 : p + 1;
+      }
+      break;
+    }
+  }
+}
+
+} // namespace
+
+LazyTensor::LazyTensor(std::shared_ptr<Tensor> base) {
+  if (!base) {
+    throw std::runtime_error("Cannot make a lazy tensor of a null tensor.");
+  }
+  this->base_ = std::move(base);
+}
+
+std::shared_ptr<LazyTensor> LazyTensor::push(Stage stage) {
+  // a new chain, so chains branching off this one don't share stages. The
+  // fused loops read the base in order: done on the first op, so a chain
+  // that stays empty costs nothing.
+  std::shared_ptr<LazyTensor> out = std::make_shared<LazyTensor>(
+      this->stages_.empty() ? this->base_->contiguous() : this->base_);
+  out->stages_ = this->stages_;
+  out->stages_.push_back(std::move(stage));
+  return out;
+}
+
+std::shared_ptr<LazyTensor> LazyTensor::binary(
+    Op op,
+    std::shared_ptr<Tensor> other) {
+  if (!other) {
+    throw std::runtime_error("Cannot add or mul a null tensor.");
+  }
+  other = other->contiguous();
+
+  // fused if `other`, without its leading 1s, is the trailing dims of the
+  // chain: element i then pairs with element i % numel of `other`
+  const std::vector<int>& shape = this->base_->shape;
+  size_t lead = 0;
+  while (lead < other->shape.size() && other->shape[lead] == 1) {
+    lead++;
+  }
+  size_t rest = other->shape.size() - lead;
+  bool fusable = other->shape.size() <= shape.size() &&
+      std::equal(other->shape.begin() + lead, other->shape.end(),
+                 shape.end() - rest);
+  if (fusable) {
+    return this->push({op, 0.0, other});
+  }
+
+  std::shared_ptr<Tensor> t = this->materialize();
+  return std::make_shared<LazyTensor>(
+      op == Op::Add ? t->add(other) : t->mul(other));
+}
+
+std::shared_ptr<LazyTensor> LazyTensor::relu() {
+  return this->push({Op::Relu});
+}
+
+std::shared_ptr<LazyTensor> LazyTensor::tanh() {
+  return this->push({Op::Tanh});
+}
+
+std::shared_ptr<LazyTensor> LazyTensor::gelu() {
+  return this->push({Op::Gelu});
+}
+
+std::shared_ptr<LazyTensor> LazyTensor::sigmoid() {
+  return this->push({Op::Sigmoid});
+}
+
+std::shared_ptr<LazyTensor> LazyTensor::leakyRelu(double alpha) {
+  return this->push({Op::LeakyRelu, alpha});
+}
+
+std::shared_ptr<LazyTensor> LazyTensor::add(std::shared_ptr<Tensor> other) {
+  return this->binary(Op::Add, std::move(other));
+}
+
+std::shared_ptr<LazyTensor> LazyTensor::mul(std::shared_ptr<Tensor> other) {
+  return this->binary(Op::Mul, std::move(other));
+}
+
+std::shared_ptr<Tensor> LazyTensor::materialize() {
+  if (this->stages_.empty()) {
+    return this->base_;
+  }
+  std::shared_ptr<Tensor> out =
+      make_node<Tensor>(this->base_->shape, Uninitialized{});
+
+  Tensor* x = this->base_.get();
+  Tensor* res = out.get();
+  std::vector<Step> steps;
+  std::vector<const Tensor*> inputs = {x};
+  std::vector<std::shared_ptr<Tensor>> prev = {this->base_};
+  for (const Stage& s : this->stages_) {
+    steps.push_back({s.op, s.alpha, s.operand.get()});
+    if (s.operand != nullptr) {
+      inputs.push_back(s.operand.get());
+      prev.push_back(s.operand);
+    }
+  }
+  // later ops chain on from the result
+  this->base_ = out;
+  this->stages_.clear();
+
+  auto forward = [x, res, steps]() {
+    parallel_for(0, x->numel(), kFusedGrain, [&](size_t lo, size_t hi) {
+      const double* in = x->data.data();
+      double* o = res->data.data();
+      for (size_t t = lo; t < hi; t += kTile) {
+        size_t len = std::min(kTile, hi - t);
+        // every op in turn over the tile, in place after the first
+        const double* src = in + t;
+        for (const Step& s : steps) {
+          apply(s, src, o + t, t, len);
+          src = o + t;
+        }
+      }
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from(inputs)) {
+    return out;
+  }
+
+  out->_prev = std::move(prev);
+  out->_op = 'F';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([x, res, steps]() {
+    size_t n = res->numel();
+    size_t k = steps.size();
+    std::mutex merge; // guards the grads of broadcast operands
+    parallel_for(0, n, kFusedGrain, [&](size_t lo, size_t hi) {
+      // where the grad of each op's operand goes. A broadcast operand is
+      // summed over the chunk first, same-shaped ones are written directly
+      // (chunks don't overlap).
+      std::vector<std::vector<double>> partial(k);
+      std::vector<double*> operand_grad(k, nullptr);
+      for (size_t s = 0; s < k; s++) {
+        Tensor* b = steps[s].operand;
+        if (b == nullptr || !b->requires_grad) {
+          continue;
+        }
+        if (b->numel() == n) {
+          operand_grad[s] = b->grad.data();
+        } else {
+          partial[s].assign(b->numel(), 0.0);
+          operand_grad[s] = partial[s].data();
+        }
+      }
+
+      // the output of every op for a tile, recomputed from x
+      std::vector<double> vals(k * kTile);
+      std::vector<double> g(kTile);
+      std::vector<const double*> ins(k + 1);
+      for (size_t t = lo; t < hi; t += kTile) {
+        size_t len = std::min(kTile, hi - t);
+        ins[0] = x->data.data() + t;
+        for (size_t s = 0; s < k; s++) {
+          apply(steps[s], ins[s], vals.data() + s * kTile, t, len);
+          ins[s + 1] = vals.data() + s * kTile;
+        }
+
+        const double* dout = res->grad.data() + t;
+        std::copy(dout, dout + len, g.begin());
+        for (size_t s = k; s-- > 0;) {
+          backprop(
+              steps[s], ins[s], ins[s + 1], g.data(), t, len, operand_grad[s]);
+        }
+        if (x->requires_grad) {
+          for (size_t j = 0; j < len; j++) {
+            x->grad[t + j] += g[j];
+          }
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(merge);
+      for (size_t s = 0; s < k; s++) {
+        if (partial[s].empty()) {
+          continue;
+        }
+        Storage& grad = steps[s].operand->grad;
+        for (size_t p = 0; p < partial[s].size(); p++) {
+          grad[p] += partial[s][p];
+        }
+      }
+    });
+  });
+
+  return out;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "tensor.h"
+
+/// LazyTensor
+/// Elementwise ops on a tensor, recorded instead of run. `materialize` runs
+/// the whole chain as one loop over the elements and gives a single tensor
+/// node, whose backward is one loop as well:
+///
+///   x->lazy()->add(bias)->relu()->materialize()
+///
+/// reads x and bias once and writes the output once, where the eager ops
+/// write (and read back) a full intermediate tensor per op. The loops go
+/// tile by tile, so the intermediates of a tile stay in L1; backward
+/// recomputes them instead of saving them.
+///
+/// Every op returns a new chain and leaves the one it's called on as it was,
+/// so two chains can branch off the same one.
+///
+/// An operand of add/mul has to be the same shape as the chain, or its
+/// trailing dims (like a bias). Other operands are broadcast the eager way:
+/// the chain so far is materialized, and a new one starts from the result.
+class LazyTensor {
+public:
+  enum class Op { Relu, Tanh, Gelu, Sigmoid, LeakyRelu, Add, Mul };
+
+  struct Stage {
+    Op op;
+    double alpha = 0.0; // leakyRelu
+    std::shared_ptr<Tensor> operand = nullptr; // add, mul
+  };
+
+private:
+  std::shared_ptr<Tensor> base_;
+  std::vector<Stage> stages_;
+
+  std::shared_ptr<LazyTensor> push(Stage stage);
+  std::shared_ptr<LazyTensor> binary(Op op, std::shared_ptr<Tensor> other);
+
+public:
+  explicit LazyTensor(std::shared_ptr<Tensor> base);
+
+  std::shared_ptr<LazyTensor> relu();
+  std::shared_ptr<LazyTensor> tanh();
+  std::shared_ptr<LazyTensor> gelu();
+  std::shared_ptr<LazyTensor> sigmoid();
+  std::shared_ptr<LazyTensor> leakyRelu(double alpha);
+  std::shared_ptr<LazyTensor> add(std::shared_ptr<Tensor> other);
+  std::shared_ptr<LazyTensor> mul(std::shared_ptr<Tensor> other);
+
+  // runs the chain. Without ops, that's the base tensor itself.
+  std::shared_ptr<Tensor> materialize();
+
+  // ops recorded and not run yet
+  size_t size() const {
+    return this->stages_.size();
+  }
+
+  const std::vector<int>& shape() const {
+    return this->base_->shape;
+  }
+};
@@ -0,0 +1,373 @@
+#include "gemm.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "simd.h"
+#include "thread_pool.h"
+
+#ifdef DEEPTENSOR_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// block sizes (in elements): a KC x NR panel of B fits in L1, an MC x KC
+// block of A in L2 and a KC x NC block of B in L3
+constexpr int kMC = 96;
+constexpr int kKC = 256;
+constexpr int kNC = 2048;
+
+// below this many multiply-adds packing costs more than it saves
+constexpr long kSmallGemm = 16 * 16 * 16;
+
+// multiply-adds worth handing to another thread
+constexpr long kParallelGemm = 64 * 64 * 64;
+
+// C[MR x NR] += A_panel . B_panel, over `kc` steps. `a` holds MR values per
+// step, `b` NR values per step.
+using MicroKernel =
+    void (*)(int kc, const double* a, const double* b, double* c, int ldc);
+
+struct Kernel {
+  const char* name;
+  int mr;
+  int nr;
+  MicroKernel fn;
+};
+
+void kernel_generic_4x8(
+    int kc,
+    const double* a,
+    const double* b,
+    double* c,
+    int ldc) {
+  double acc[4][8] = {};
+  for (int p = 0; p < kc; p++) {
+    for (int i = 0; i < 4; i++) {
+      double a_i = a[p * 4 + i];
+      for (int j = 0; j < 8; j++) {
+        acc[i][j] += a_i * b[p * 8 + j];
+      }
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 8; j++) {
+      c[i * ldc + j] += acc[i][j];
+    }
+  }
+}
+
+#ifdef DEEPTENSOR_X86_KERNELS
+// 4 rows x 2 ymm: 8 accumulators, enough to hide the FMA latency
+__attribute__((target("avx2,fma"))) void kernel_avx2_4x8(
+    int kc,
+    const double* a,
+    const double* b,
+    double* c,
+    int ldc) {
+  __m256d acc[4][2];
+  for (int i = 0; i < 4; i++) {
+    acc[i][0] = _mm256_setzero_pd();
+    acc[i][1] = _mm256_setzero_pd();
+  }
+  for (int p = 0; p < kc; p++) {
+    __m256d b0 = _mm256_loadu_pd(b + p * 8);
+    __m256d b1 = _mm256_loadu_pd(b + p * 8 + 4);
+    for (int i = 0; i < 4; i++) {
+      __m256d a_i = _mm256_broadcast_sd(a + p * 4 + i);
+      acc[i][0] = _mm256_fmadd_pd(a_i, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_pd(a_i, b1, acc[i][1]);
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    double* row = c + i * ldc;
+    _mm256_storeu_pd(row, _mm256_add_pd(_mm256_loadu_pd(row), acc[i][0]));
+    _mm256_storeu_pd(
+        row + 4, _mm256_add_pd(_mm256_loadu_pd(row + 4), acc[i][1]));
+  }
+}
+
+// 4 rows x 2 zmm
+__attribute__((target("avx512f"))) void kernel_avx512_4x16(
+    int kc,
+    const double* a,
+    const double* b,
+    double* c,
+    int ldc) {
+  __m512d acc[4][2];
+  for (int i = 0; i < 4; i++) {
+    acc[i][0] = _mm512_setzero_pd();
+    acc[i][1] = _mm512_setzero_pd();
+  }
+  for (int p = 0; p < kc; p++) {
+    __m512d b0 = _mm512_loadu_pd(b + p * 16);
+    __m512d b1 = _mm512_loadu_pd(b + p * 16 + 8);
+    for (int i = 0; i < 4; i++) {
+      __m512d a_i = _mm512_set1_pd(a[p * 4 + i]);
+      acc[i][0] = _mm512_fmadd_pd(a_i, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_pd(a_i, b1, acc[i][1]);
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    double* row = c + i * ldc;
+    _mm512_storeu_pd(row, _mm512_add_pd(_mm512_loadu_pd(row), acc[i][0]));
+    _mm512_storeu_pd(
+        row + 8, _mm512_add_pd(_mm512_loadu_pd(row + 8), acc[i][1]));
+  }
+}
+#endif
+
+const Kernel kGeneric = {"generic", 4, 8, kernel_generic_4x8};
+#ifdef DEEPTENSOR_X86_KERNELS
+const Kernel kAvx2 = {"avx2", 4, 8, kernel_avx2_4x8};
+const Kernel kAvx512 = {"avx512", 4, 16, kernel_avx512_4x16};
+#endif
+
+bool supported(const Kernel& kernel) {
+#ifdef DEEPTENSOR_X86_KERNELS
+  if (&kernel == &kAvx512) {
+    return cpu_has_avx512();
+  }
+  if (&kernel == &kAvx2) {
+    return cpu_has_avx2();
+  }
+#endif
+  return &kernel == &kGeneric;
+}
+
+const Kernel* best_kernel() {
+#ifdef DEEPTENSOR_X86_KERNELS
+  if (supported(kAvx512)) {
+    return &kAvx512;
+  }
+  if (supported(kAvx2)) {
+    return &kAvx2;
+  }
+#endif
+  return &kGeneric;
+}
+
+const Kernel*& active_kernel() {
+  static const Kernel* kernel = best_kernel();
+  return kernel;
+}
+
+// MR x kc panels of the mc x kc block of op(A) at (ic, pc), zero padded
+void pack_a(
+    bool trans,
+    const double* a,
+    int lda,
+    int ic,
+    int pc,
+    int mc,
+    int kc,
+    int mr,
+    double* out) {
+  for (int ir = 0; ir < mc; ir += mr) {
+    int rows = std::min(mr, mc - ir);
+    for (int p = 0; p < kc; p++) {
+      for (int r = 0; r < mr; r++) {
+        int i = ic + ir + r;
+        int kk = pc + p;
+        *out++ = r >= rows ? 0.0 : trans ? a[kk * lda + i] : a[i * lda + kk];
+      }
+    }
+  }
+}
+
+// kc x NR panels of the kc x nc block of op(B) at (pc, jc), zero padded
+void pack_b(
+    bool trans,
+    const double* b,
+    int ldb,
+    int pc,
+    int jc,
+    int kc,
+    int nc,
+    int nr,
+    double* out) {
+  for (int jr = 0; jr < nc; jr += nr) {
+    int cols = std::min(nr, nc - jr);
+    for (int p = 0; p < kc; p++) {
+      for (int q = 0; q < nr; q++) {
+        int kk = pc + p;
+        int j = jc + jr + q;
+        *out++ = q >= cols ? 0.0 : trans ? b[j * ldb + kk] : b[kk * ldb + j];
+      }
+    }
+  }
+}
+
+// plain loops, for sizes where packing isn't worth it
+void gemm_small(
+    bool trans_a,
+    bool trans_b,
+    int m,
+    int n,
+    int k,
+    const double* a,
+    int lda,
+    const double* b,
+    int ldb,
+    double* c,
+    int ldc) {
+  for (int i = 0; i < m; i++) {
+    for (int p = 0; p < k; p++) {
+      double a_ip = trans_a ? a[p * lda + i] : a[i * lda + p];
+      for (int j = 0; j < n; j++) {
+        double b_pj = trans_b ? b[j * ldb + p] : b[p * ldb + j];
+        c[i * ldc + j] += a_ip * b_pj;
+      }
+    }
+  }
+}
+
+} // namespace
+
+void gemm(
+    bool trans_a,
+    bool trans_b,
+    int m,
+    int n,
+    int k,
+    const double* a,
+    int lda,
+    const double* b,
+    int ldb,
+    double* c,
+    int ldc) {
+  if (m <= 0 || n <= 0 || k <= 0) {
+    return;
+  }
+  if (long(m) * n * k <= kSmallGemm) {
+    gemm_small(trans_a, trans_b, m, n, k, a, lda, b, ldb, c, ldc);
+    return;
+  }
+
+  const Kernel& kernel = *active_kernel();
+  int mr = kernel.mr;
+  int nr = kernel.nr;
+
+  // row blocks of C are split between threads. Short of kMC rows a thread,
+  // the blocks shrink (to a multiple of mr) so every thread gets some.
+  int threads = get_num_threads();
+  int mc_block = (m + threads - 1) / threads;
+  mc_block = std::min(kMC, std::max(mr, (mc_block + mr - 1) / mr * mr));
+  size_t num_blocks = (m + mc_block - 1) / mc_block;
+
+  // B is packed by the calling thread and shared, A by each thread
+  thread_local std::vector<double> packed_b;
+  packed_b.resize(size_t(kNC + nr) * kKC);
+  const double* b_packed = packed_b.data();
+
+  for (int jc = 0; jc < n; jc += kNC) {
+    int nc = std::min(kNC, n - jc);
+    for (int pc = 0; pc < k; pc += kKC) {
+      int kc = std::min(kKC, k - pc);
+      pack_b(trans_b, b, ldb, pc, jc, kc, nc, nr, packed_b.data());
+
+      // blocks a thread, for at least kParallelGemm multiply-adds each
+      long block_work = long(mc_block) * nc * kc;
+      size_t grain = (kParallelGemm + block_work - 1) / block_work;
+      parallel_for(0, num_blocks, grain, [&](size_t lo, size_t hi) {
+        thread_local std::vector<double> packed_a;
+        packed_a.resize(size_t(kMC + mr) * kKC);
+        double tile[16 * 16]; // an edge tile, mr x nr at most
+
+        for (size_t block = lo; block < hi; block++) {
+          int ic = int(block) * mc_block;
+          int mc = std::min(mc_block, m - ic);
+          pack_a(trans_a, a, lda, ic, pc, mc, kc, mr, packed_a.data());
+
+          for (int jr = 0; jr < nc; jr += nr) {
+            const double* b_panel = b_packed + size_t(jr) * kc;
+            int cols = std::min(nr, nc - jr);
+            for (int ir = 0; ir < mc; ir += mr) {
+              const double* a_panel = packed_a.data() + size_t(ir) * kc;
+              int rows = std::min(mr, mc - ir);
+              double* c_tile = c + size_t(ic + ir) * ldc + jc + jr;
+              if (rows == mr && cols == nr) {
+                kernel.fn(kc, a_panel, b_panel, c_tile, ldc);
+                continue;
+              }
+              // partial tile: compute it whole, then add the valid part
+              std::fill(tile, tile + mr * nr, 0.0);
+              kernel.fn(kc, a_panel, b_panel, tile, nr);
+              for (int i = 0; i < rows; i++) {
+                for (int j = 0; j < cols; j++) {
+                  c_tile[i * ldc + j] += tile[i * nr + j];
+                }
+              }
+            }
+          }
+        }
+      });
+    }
+  }
+}
+
+std::string gemm_kernel() {
+  return active_kernel()->name;
+}
+
+bool set_gemm_kernel(const std::string& name) {
+  std::vector<const Kernel*> kernels = {&kGeneric};
+#ifdef DEEPTENSOR_X86_KERNELS
+  kernels.push_back(&kAvx2);
+  kernels.push_back(&kAvx512);
+#endif
+  for (const Kernel* kernel : kernels) {
+    if (name == kernel->name && supported(*kernel)) {
+      active_kernel() = kernel;
+      return true;
+    }
+  }
+  return false;
+}
+
+void gemm_batched(
+    int batch,
+    bool trans_a,
+    bool trans_b,
+    int m,
+    int n,
+    int k,
+    const double* a,
+    int lda,
+    long stride_a,
+    const double* b,
+    int ldb,
+    long stride_b,
+    double* c,
+    int ldc,
+    long stride_c) {
+  if (batch <= 0) {
+    return;
+  }
+  // shared B and stacked A, C rows: one (batch * m) x n product
+  if (stride_b == 0 && !trans_a && stride_a == long(m) * lda &&
+      stride_c == long(m) * ldc) {
+    gemm(false, trans_b, batch * m, n, k, a, lda, b, ldb, c, ldc);
+    return;
+  }
+  // sum of A_b^T . B_b over stacked A, B rows: the batches extend k
+  if (stride_c == 0 && trans_a && !trans_b && stride_a == long(k) * lda &&
+      stride_b == long(k) * ldb) {
+    gemm(true, false, m, n, batch * k, a, lda, b, ldb, c, ldc);
+    return;
+  }
+  for (int i = 0; i < batch; i++) {
+    gemm(
+        trans_a,
+        trans_b,
+        m,
+        n,
+        k,
+        a + i * stride_a,
+        lda,
+        b + i * stride_b,
+        ldb,
+        c + i * stride_c,
+        ldc);
+  }
+}
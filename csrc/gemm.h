@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+
+/// Gemm
+/// C += op(A) . op(B) on row-major doubles, where op(X) is X or X^T.
+/// C is m x n, op(A) is m x k and op(B) is k x n; `lda`, `ldb` and `ldc`
+/// are the row strides of A, B and C as they're stored (before op).
+///
+/// Cache blocked (Goto style): B is packed in k x NR panels that stay in L1,
+/// A in MR x k panels that stay in L2, and a register-blocked MR x NR
+/// micro-kernel runs over them. The packing also does the transposes, so
+/// there's a single kernel for every case. The kernel is picked at runtime
+/// from what the CPU supports: AVX-512, AVX2 + FMA, or a portable one.
+void gemm(
+    bool trans_a,
+    bool trans_b,
+    int m,
+    int n,
+    int k,
+    const double* a,
+    int lda,
+    const double* b,
+    int ldb,
+    double* c,
+    int ldc);
+
+// micro-kernel in use: "avx512", "avx2" or "generic"
+std::string gemm_kernel();
+
+// use a given micro-kernel (for tests & benchmarks). Returns false, and
+// keeps the current one, if the CPU doesn't support it.
+bool set_gemm_kernel(const std::string& name);
+
+/// Batched gemm: for b in [0, batch),
+///   C_b += op(A_b) . op(B_b),  X_b = x + b * stride_x.
+/// A stride of 0 reuses one matrix for every batch (a broadcast operand);
+/// with `stride_c == 0` the products are summed into a single C. The cases
+/// that are really one big product (a shared B, or a summed C over stacked
+/// A^T and B) run as a single gemm, so B is packed once.
+void gemm_batched(
+    int batch,
+    bool trans_a,
+    bool trans_b,
+    int m,
+    int n,
+    int k,
+    const double* a,
+    int lda,
+    long stride_a,
+    const double* b,
+    int ldb,
+    long stride_b,
+    double* c,
+    int ldc,
+    long stride_c);
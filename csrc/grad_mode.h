@@ -0,0 +1,100 @@
+#pragma once
+
+/// GradMode
+/// Whether ops record the autograd graph on the current thread. With it off,
+/// Value and Tensor ops only compute the forward data: no `_prev`, no tape
+/// record and no backward closure, so the results are plain leaves.
+///
+/// While a step is captured (see CapturedStep), ops also record the graph of
+/// outputs that don't require grad: their forward closures have to be
+/// replayed, even if no gradient flows through them.
+class GradMode {
+private:
+  static bool& enabled() {
+    static thread_local bool enabled = true;
+    return enabled;
+  }
+
+  static bool& capturing() {
+    static thread_local bool capturing = false;
+    return capturing;
+  }
+
+public:
+  static bool is_enabled() {
+    return enabled();
+  }
+
+  static void set_enabled(bool enabled) {
+    GradMode::enabled() = enabled;
+  }
+
+  static bool is_capturing() {
+    return capturing();
+  }
+
+  static void set_capturing(bool capturing) {
+    GradMode::capturing() = capturing;
+  }
+};
+
+// disables graph recording for its lifetime, for inference:
+//
+//   {
+//     NoGradGuard no_grad;
+//     auto out = model->call(inputs);
+//   }
+class NoGradGuard {
+private:
+  bool prev_;
+
+public:
+  NoGradGuard() : prev_(GradMode::is_enabled()) {
+    GradMode::set_enabled(false);
+  }
+
+  ~NoGradGuard() {
+    GradMode::set_enabled(this->prev_);
+  }
+
+  NoGradGuard(const NoGradGuard&) = delete;
+  NoGradGuard& operator=(const NoGradGuard&) = delete;
+};
+
+// turns graph recording back on for its lifetime, e.g. to recompute a
+// checkpointed segment during a backward pass
+class EnableGradGuard {
+private:
+  bool prev_;
+
+public:
+  EnableGradGuard() : prev_(GradMode::is_enabled()) {
+    GradMode::set_enabled(true);
+  }
+
+  ~EnableGradGuard() {
+    GradMode::set_enabled(this->prev_);
+  }
+
+  EnableGradGuard(const EnableGradGuard&) = delete;
+  EnableGradGuard& operator=(const EnableGradGuard&) = delete;
+};
+
+// records the whole forward graph for its lifetime, the parts that don't
+// require grad too, so a CapturedStep can replay all of it
+class CaptureGraphGuard {
+private:
+  bool prev_;
+
+public:
+  CaptureGraphGuard() : prev_(GradMode::is_capturing()) {
+    GradMode::set_capturing(true);
+  }
+
+  ~CaptureGraphGuard() {
+    GradMode::set_capturing(this->prev_);
+  }
+
+  CaptureGraphGuard(const CaptureGraphGuard&) = delete;
+  CaptureGraphGuard& operator=(const CaptureGraphGuard&) = delete;
+};
@@ -1,9 +1,21 @@
 #pragma once
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../arena.h"
 #include "../neural_network.h"
 #include "../tensor.h"
+#include "../thread_pool.h"
 #include "../utils.h"
 
+// channels a thread takes, when each one costs `work` multiply-adds
+inline size_t channel_grain(int work) {
+  return 1 + (1 << 15) / std::max(work, 1);
+}
+
 class Conv2D : public Layer {
 private:
   int in_channels;
@@ -23,6 +35,8 @@ private:
     this->weights = std::make_shared<Tensor>(
         std::vector<int>{out_channels, in_channels, kernel_size, kernel_size});
     this->bias = std::make_shared<Tensor>(std::vector<int>{out_channels});
+    this->weights->requires_grad = true;
+    this->bias->requires_grad = true;
 
     // Determine the seed to use
     int seed_to_use = (this->seed == -1) ? 42 : this->seed;
@@ -34,16 +48,10 @@ private:
         this->in_channels,
         this->out_channels,
         seed_to_use);
-    for (int oc = 0; oc < out_channels; ++oc) {
-      for (int ic = 0; ic < in_channels; ++ic) {
-        for (int kh = 0; kh < kernel_size; ++kh) {
-          for (int kw = 0; kw < kernel_size; ++kw) {
-            double weight = rng.generate();
-            weights->set({oc, ic, kh, kw}, std::make_shared<Value>(weight));
-          }
-        }
-      }
-      bias->set(oc, std::make_shared<Value>(0.0));
+    // weights are stored row-major, so they're filled in (oc, ic, kh, kw)
+    // order. bias is already zero-initialized.
+    for (auto& e : weights->data) {
+      e = rng.generate();
     }
   }
 
@@ -99,6 +107,7 @@ public:
 
   std::shared_ptr<Tensor> call(std::shared_ptr<Tensor> input, bool using_cuda)
       override {
+    input = input->contiguous();
     auto input_shape = input->shape; // [batch_size, in_channels, height, width]
                                      // -- no batch for now
     // int batch = input_shape[0];
@@ -106,37 +115,172 @@ public:
     int height = input_shape[1];
     int width = input_shape[2];
 
+    if (in_channel != in_channels) {
+      throw std::invalid_argument(
+          "Conv2D expects input with " + std::to_string(in_channels) +
+          " channels, but got: " + std::to_string(in_channel));
+    }
+
     // Compute output dimensions
     int output_height = (height - kernel_size + 2 * padding) / stride + 1;
     int output_width = (width - kernel_size + 2 * padding) / stride + 1;
 
     // Output tensor
-    auto output = std::make_shared<Tensor>(
-        std::vector<int>{out_channels, output_height, output_width});
-
-    for (int oc = 0; oc < out_channels; ++oc) {
-      for (int oh = 0; oh < output_height; ++oh) {
-        for (int ow = 0; ow < output_width; ++ow) {
-          // Compute the dot product of the kernel and the input patch
-          std::shared_ptr<Value> result = std::make_shared<Value>(0.0);
-          for (int ic = 0; ic < in_channels; ++ic) {
-            for (int kh = 0; kh < kernel_size; ++kh) {
-              for (int kw = 0; kw < kernel_size; ++kw) {
-                int ih = oh * stride + kh - padding;
-                int iw = ow * stride + kw - padding;
-                if (ih >= 0 && ih < height && iw >= 0 && iw < width) {
-                  result = result->add(input->get({ic, ih, iw})->mul(
-                      weights->get({oc, ic, kh, kw})));
+    auto output = make_node<Tensor>(
+        std::vector<int>{out_channels, output_height, output_width},
+        Uninitialized{});
+
+    Tensor* input_ptr = input.get();
+    Tensor* w_ptr = weights.get();
+    Tensor* b_ptr = bias.get();
+    Tensor* res = output.get();
+    auto forward = [input_ptr,
+                    w_ptr,
+                    b_ptr,
+                    res,
+                    in_channels = in_channels,
+                    out_channels = out_channels,
+                    kernel_size = kernel_size,
+                    stride = stride,
+                    padding = padding,
+                    height,
+                    width,
+                    output_height,
+                    output_width]() {
+      const double* in = input_ptr->data.data();
+      const double* w = w_ptr->data.data();
+      const double* b = b_ptr->data.data();
+      double* out = res->data.data();
+
+      // output channels are independent, they're split between threads
+      size_t grain = channel_grain(
+          output_height * output_width * in_channels * kernel_size *
+          kernel_size);
+      parallel_for(0, out_channels, grain, [&](size_t lo, size_t hi) {
+        for (int oc = int(lo); oc < int(hi); ++oc) {
+          for (int oh = 0; oh < output_height; ++oh) {
+            for (int ow = 0; ow < output_width; ++ow) {
+              // Compute the dot product of the kernel and the input patch
+              double result = 0.0;
+              for (int ic = 0; ic < in_channels; ++ic) {
+                for (int kh = 0; kh < kernel_size; ++kh) {
+                  for (int kw = 0; kw < kernel_size; ++kw) {
+                    int ih = oh * stride + kh - padding;
+                    int iw = ow * stride + kw - padding;
+                    if (ih >= 0 && ih < height && iw >= 0 && iw < width) {
+                      result += in[(ic * height + ih) * width + iw] *
+                          w[((oc * in_channels + ic) * kernel_size + kh) *
+                                kernel_size +
+                            kw];
+                    }
+                  }
                 }
               }
+              result += b[oc]; // Add bias
+              out[(oc * output_height + oh) * output_width + ow] = result;
             }
           }
-          result = result->add(bias->get(oc)); // Add bias
-          output->set({oc, oh, ow}, result);
         }
-      }
+      });
+    };
+    forward();
+
+    if (!output->record_grad_from({input_ptr, w_ptr, b_ptr})) {
+      return output;
     }
 
+    output->_prev = {input, weights, bias};
+    output->_op = 'C';
+
+    output->setForwardMethod(forward);
+    output->setBackWardMethod([input_ptr,
+                               w_ptr,
+                               b_ptr,
+                               res,
+                               in_channels = in_channels,
+                               out_channels = out_channels,
+                               kernel_size = kernel_size,
+                               stride = stride,
+                               padding = padding,
+                               height,
+                               width,
+                               output_height,
+                               output_width]() {
+      const double* in = input_ptr->data.data();
+      const double* w = w_ptr->data.data();
+      const double* dout = res->grad.data();
+      // only the gradients that are needed
+      bool need_din = input_ptr->requires_grad;
+      bool need_dw = w_ptr->requires_grad;
+      bool need_db = b_ptr->requires_grad;
+      double* din = input_ptr->grad.data();
+      double* dw = w_ptr->grad.data();
+      double* db = b_ptr->grad.data();
+      size_t grain = channel_grain(
+          output_height * output_width * in_channels * kernel_size *
+          kernel_size);
+
+      // calls fn(in_idx, w_idx, g) for every input element under the kernel,
+      // for the output channels [oc_lo, oc_hi) and the input
+      // channels [ic_lo, ic_hi)
+      auto for_each_tap = [&](int oc_lo,
+                              int oc_hi,
+                              int ic_lo,
+                              int ic_hi,
+                              auto&& fn) {
+        for (int oc = oc_lo; oc < oc_hi; ++oc) {
+          for (int oh = 0; oh < output_height; ++oh) {
+            for (int ow = 0; ow < output_width; ++ow) {
+              double g = dout[(oc * output_height + oh) * output_width + ow];
+              for (int ic = ic_lo; ic < ic_hi; ++ic) {
+                for (int kh = 0; kh < kernel_size; ++kh) {
+                  for (int kw = 0; kw < kernel_size; ++kw) {
+                    int ih = oh * stride + kh - padding;
+                    int iw = ow * stride + kw - padding;
+                    if (ih >= 0 && ih < height && iw >= 0 && iw < width) {
+                      int in_idx = (ic * height + ih) * width + iw;
+                      int w_idx =
+                          ((oc * in_channels + ic) * kernel_size + kh) *
+                              kernel_size +
+                          kw;
+                      fn(in_idx, w_idx, g);
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      };
+
+      // dW and db split by output channel, dX by input channel, so no two
+      // threads write the same element
+      if (need_db) {
+        for (int oc = 0; oc < out_channels; ++oc) {
+          int plane = output_height * output_width;
+          for (int i = 0; i < plane; ++i) {
+            db[oc] += dout[oc * plane + i];
+          }
+        }
+      }
+      if (need_dw) {
+        parallel_for(0, out_channels, grain, [&](size_t lo, size_t hi) {
+          for_each_tap(
+              int(lo), int(hi), 0, in_channels, [&](int i, int wi, double g) {
+                dw[wi] += in[i] * g;
+              });
+        });
+      }
+      if (need_din) {
+        parallel_for(0, in_channels, grain, [&](size_t lo, size_t hi) {
+          for_each_tap(
+              0, out_channels, int(lo), int(hi), [&](int i, int wi, double g) {
+                din[i] += w[wi] * g;
+              });
+        });
+      }
+    });
+
     return output;
   }
 
@@ -153,15 +297,8 @@ public:
     this->bias->zero_grad();
   }
 
-  std::vector<std::shared_ptr<Value>> parameters() override {
-    std::vector<std::shared_ptr<Value>> out;
-    for (int i = 0; i <= this->weights->maxIdx; i++) {
-      out.push_back(this->weights->get(i));
-    }
-    for (int i = 0; i <= this->bias->maxIdx; i++) {
-      out.push_back(this->bias->get(i));
-    }
-    return out;
+  std::vector<std::shared_ptr<Tensor>> parameters() override {
+    return {this->weights, this->bias};
   }
 };
 
@@ -177,6 +314,7 @@ public:
 
   std::shared_ptr<Tensor> call(std::shared_ptr<Tensor> input, bool using_cuda)
       override {
+    input = input->contiguous();
     auto input_shape = input->shape; // [batch_size, channels, height, width] --
                                      // no batch for now
     // int batch_size = input_shape[0];
@@ -189,31 +327,82 @@ public:
     int output_width = (width - pool_size) / stride + 1;
 
     // Output tensor
-    auto output = std::make_shared<Tensor>(
-        std::vector<int>{channels, output_height, output_width});
-
-    for (int c = 0; c < channels; ++c) {
-      for (int oh = 0; oh < output_height; ++oh) {
-        for (int ow = 0; ow < output_width; ++ow) {
-          std::shared_ptr<Value> max_val =
-              std::make_shared<Value>(-std::numeric_limits<double>::infinity());
-          for (int ph = 0; ph < pool_size; ++ph) {
-            for (int pw = 0; pw < pool_size; ++pw) {
-              int ih = oh * stride + ph;
-              int iw = ow * stride + pw;
-              if (ih < height && iw < width) {
-                std::shared_ptr<Value> curr_val = input->get({c, ih, iw});
-                if (max_val->data < curr_val->data) {
-                  max_val = curr_val;
+    auto output = make_node<Tensor>(
+        std::vector<int>{channels, output_height, output_width},
+        Uninitialized{});
+
+    // flat index of the max element of each window, -1 if none was found.
+    // Written by forward and read by backward.
+    auto argmax = std::make_shared<std::vector<int>>(output->data.size(), -1);
+
+    Tensor* input_ptr = input.get();
+    Tensor* res = output.get();
+    auto forward = [input_ptr,
+                    res,
+                    argmax,
+                    pool_size = pool_size,
+                    stride = stride,
+                    channels,
+                    height,
+                    width,
+                    output_height,
+                    output_width]() {
+      const double* in = input_ptr->data.data();
+      double* out = res->data.data();
+
+      size_t grain =
+          channel_grain(output_height * output_width * pool_size * pool_size);
+      parallel_for(0, channels, grain, [&](size_t lo, size_t hi) {
+        for (int c = int(lo); c < int(hi); ++c) {
+          for (int oh = 0; oh < output_height; ++oh) {
+            for (int ow = 0; ow < output_width; ++ow) {
+              double max_val = -std::numeric_limits<double>::infinity();
+              int max_idx = -1;
+              for (int ph = 0; ph < pool_size; ++ph) {
+                for (int pw = 0; pw < pool_size; ++pw) {
+                  int ih = oh * stride + ph;
+                  int iw = ow * stride + pw;
+                  if (ih < height && iw < width) {
+                    int in_idx = (c * height + ih) * width + iw;
+                    if (max_val < in[in_idx]) {
+                      max_val = in[in_idx];
+                      max_idx = in_idx;
+                    }
+                  }
                 }
               }
+              int out_idx = (c * output_height + oh) * output_width + ow;
+              out[out_idx] = max_val;
+              (*argmax)[out_idx] = max_idx;
             }
           }
-          output->set({c, oh, ow}, max_val);
         }
-      }
+      });
+    };
+    forward();
+
+    if (!output->record_grad_from({input_ptr})) {
+      return output;
     }
 
+    output->_prev = {input};
+    output->_op = 'M';
+
+    output->setForwardMethod(forward);
+    output->setBackWardMethod([input_ptr, res, argmax, channels]() {
+      // only the max element of each window receives the gradient. Windows
+      // may overlap within a channel, so threads split the channels.
+      size_t plane = argmax->size() / channels;
+      parallel_for(
+          0, channels, channel_grain(plane), [&](size_t lo, size_t hi) {
+            for (size_t i = lo * plane; i < hi * plane; i++) {
+              if ((*argmax)[i] >= 0) {
+                input_ptr->grad[(*argmax)[i]] += res->grad[i];
+              }
+            }
+          });
+    });
+
     return output;
   }
 
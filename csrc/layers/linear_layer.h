@@ -20,6 +20,8 @@ private:
     this->weights =
         std::make_shared<Tensor>(std::vector<int>{this->nin, this->nout});
     this->bias = std::make_shared<Tensor>(std::vector<int>{this->nout});
+    this->weights->requires_grad = true;
+    this->bias->requires_grad = true;
 
     // Determine the seed to use
     int seed_to_use = (this->seed == -1) ? 42 : this->seed;
@@ -28,17 +30,11 @@ private:
     RandomNumberGenerator rng(
         this->technique, this->mode, this->nin, this->nout, seed_to_use);
 
-    for (int i = 0; i < this->nin; i++) {
-      for (int j = 0; j < this->nout; j++) {
-        double data = rng.generate();
-        std::shared_ptr<Value> curr_v = std::make_shared<Value>(data);
-
-        this->weights->set({i, j}, curr_v);
-      }
-    }
-    for (int j = 0; j < this->nout; j++) {
-      this->bias->set(j, std::make_shared<Value>(0));
+    // weights are stored row-major, so they're filled in (i, j) order
+    for (auto& e : this->weights->data) {
+      e = rng.generate();
     }
+    // bias is already zero-initialized
   }
 
 public:
@@ -73,15 +69,25 @@ public:
 
   std::shared_ptr<Tensor> call(std::shared_ptr<Tensor> input, bool using_cuda)
       override {
-    if (input->shape[0] != this->nin) {
+    return this->call_lazy(input->lazy())->materialize();
+  }
+
+  // the bias add is elementwise, so it's left to fuse with what follows
+  std::shared_ptr<LazyTensor> call_lazy(
+      std::shared_ptr<LazyTensor> input) override {
+    if (input->shape().back() != this->nin) {
       std::string error_msg =
           "Input tensor shape mismatch with layer's weights. Expected input size: " +
           std::to_string(this->nin) +
-          ", but got input of size: " + std::to_string(input->shape[0]);
+          ", but got input of size: " + std::to_string(input->shape().back());
       throw std::invalid_argument(error_msg);
     }
-    std::shared_ptr<Tensor> out = input->matmul(this->weights)->add(this->bias);
-    return out;
+    std::shared_ptr<Tensor> x = input->materialize();
+    std::shared_ptr<Tensor> out = x->matmul(this->weights);
+    if (x->dims() == 1) {
+      out = out->squeeze(0); // matmul gives a single row for a 1-D input
+    }
+    return out->lazy()->add(this->bias);
   }
 
   void zero_grad() override {
@@ -95,14 +101,7 @@ public:
     return s;
   }
 
-  std::vector<std::shared_ptr<Value>> parameters() override {
-    std::vector<std::shared_ptr<Value>> out;
-    for (int i = 0; i <= this->weights->maxIdx; i++) {
-      out.push_back(this->weights->get(i));
-    }
-    for (int i = 0; i <= this->bias->maxIdx; i++) {
-      out.push_back(this->bias->get(i));
-    }
-    return out;
+  std::vector<std::shared_ptr<Tensor>> parameters() override {
+    return {this->weights, this->bias};
   }
 };
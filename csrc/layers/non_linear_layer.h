@@ -9,6 +9,11 @@ public:
     return input->relu();
   }
 
+  std::shared_ptr<LazyTensor> call_lazy(
+      std::shared_ptr<LazyTensor> input) override {
+    return input->relu();
+  }
+
   std::string printMe() override {
     return "ReLu()";
   }
@@ -23,6 +28,11 @@ public:
     return input->gelu();
   }
 
+  std::shared_ptr<LazyTensor> call_lazy(
+      std::shared_ptr<LazyTensor> input) override {
+    return input->gelu();
+  }
+
   std::string printMe() override {
     return "GeLu()";
   }
@@ -37,6 +47,11 @@ public:
     return input->tanh();
   }
 
+  std::shared_ptr<LazyTensor> call_lazy(
+      std::shared_ptr<LazyTensor> input) override {
+    return input->tanh();
+  }
+
   std::string printMe() override {
     return "Tanh()";
   }
@@ -51,6 +66,11 @@ public:
     return input->sigmoid();
   }
 
+  std::shared_ptr<LazyTensor> call_lazy(
+      std::shared_ptr<LazyTensor> input) override {
+    return input->sigmoid();
+  }
+
   std::string printMe() override {
     return "Sigmoid()";
   }
@@ -67,6 +87,11 @@ public:
     return input->leakyRelu(this->alpha);
   }
 
+  std::shared_ptr<LazyTensor> call_lazy(
+      std::shared_ptr<LazyTensor> input) override {
+    return input->leakyRelu(this->alpha);
+  }
+
   std::string printMe() override {
     return "LeakyReLu(" + std::to_string(this->alpha) + ")";
   }
@@ -1,7 +1,12 @@
 #include "loss.h"
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
+#include "arena.h"
+#include "reduce.h"
 #include "value.h"
 
 std::shared_ptr<Value> mean_squared_error(
@@ -15,15 +20,60 @@ std::shared_ptr<Value> mean_squared_error(
         x_shape_str + ") vs tensor-1 shape(" + y_shape_str + ")\n";
     throw std::runtime_error(error_string);
   }
-  std::shared_ptr<Value> out = std::make_shared<Value>(0.0);
-  int n = x->maxIdx;
+  x = x->contiguous();
+  y = y->contiguous();
+  // single tensor-op node: out = sum((x - y)^2) / n
+  std::shared_ptr<Tensor> out =
+      make_node<Tensor>(std::vector<int>{1}, Uninitialized{});
+  int n = x->maxIdx + 1;
 
-  for (int i = 0; i <= n; i++) {
-    std::shared_ptr<Value> diff = x->get(i)->sub(y->get(i));
-    std::shared_ptr<Value> diff_squared = diff->pow(2);
-    out = out->add(diff_squared);
+  Tensor* x_ptr = x.get();
+  Tensor* y_ptr = y.get();
+  Tensor* res = out.get();
+  auto forward = [x_ptr, y_ptr, res, n]() {
+    const double* xd = x_ptr->data.data();
+    const double* yd = y_ptr->data.data();
+    double sum = tree_sum(size_t(n), [xd, yd](size_t i) {
+      double diff = xd[i] - yd[i];
+      return diff * diff;
+    });
+    res->data[0] = sum / n;
+  };
+  forward();
+
+  if (!out->record_grad_from({x_ptr, y_ptr})) {
+    return out->get(0);
   }
-  return out->div(n + 1);
+
+  out->_prev = {x, y};
+  out->_op = 'm';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([x_ptr, y_ptr, res, n]() {
+    double g = res->grad[0];
+    for (int i = 0; i < n; i++) {
+      double d = 2.0 * (x_ptr->data[i] - y_ptr->data[i]) / n * g;
+      if (x_ptr->requires_grad) {
+        x_ptr->grad[i] += d;
+      }
+      if (y_ptr->requires_grad) {
+        y_ptr->grad[i] -= d;
+      }
+    }
+  });
+  return out->get(0);
+}
+
+// max of the logits (for numerical stability) and sum of exp(x_i - max)
+static void softmax_stats(
+    const Storage& logits,
+    double& max_val,
+    double& sum_exp) {
+  max_val = *std::max_element(logits.begin(), logits.end());
+  const double* x = logits.data();
+  double m = max_val;
+  sum_exp = tree_sum(
+      logits.size(), [x, m](size_t i) { return std::exp(x[i] - m); });
 }
 
 std::shared_ptr<Value> cross_entropy(
@@ -34,30 +84,85 @@ std::shared_ptr<Value> cross_entropy(
         "Expected Idx can't be smaller than 0. Got: " +
         std::to_string(actualIdx));
   }
-  if (logits->shape.size() != 1 || logits->shape[0] < actualIdx) {
+  if (logits->shape.size() != 1 || logits->shape[0] <= actualIdx) {
     throw std::runtime_error(
         "logits must be a one-dimensional tensor. And actualIdx must be smaller than logits size. Got: logits shape =>" +
         logits->tensor_shape_str() +
         ", and expectedIdx: " + std::to_string(actualIdx));
   }
-  // compute softmax of logits
-  std::shared_ptr<Tensor> logits_softmax = logits->softmax();
+  logits = logits->contiguous();
+  // single tensor-op node: out = -ln(softmax(logits)[actualIdx])
+  std::shared_ptr<Tensor> out =
+      make_node<Tensor>(std::vector<int>{1}, Uninitialized{});
 
-  constexpr double EPSILION = 1e-6;
+  Tensor* logits_ptr = logits.get();
+  Tensor* res = out.get();
+  auto forward = [logits_ptr, res, actualIdx]() {
+    constexpr double EPSILION = 1e-6;
 
-  for (int z = 0; z < logits_softmax->maxIdx; z++) {
-    if (logits_softmax->get(z)->data <= 0.0) {
-      logits_softmax->set(
-          z, std::make_shared<Value>(EPSILION)); // Handle near-zero values
-    } else if (logits_softmax->get(z)->data >= 1.0) {
-      logits_softmax->set(
-          z, std::make_shared<Value>(1.0 - EPSILION)); // Handle near-one values
+    double max_val = 0.0;
+    double sum_exp = 0.0;
+    softmax_stats(logits_ptr->data, max_val, sum_exp);
+    double p = std::exp(logits_ptr->data[actualIdx] - max_val) / sum_exp;
+
+    // Handle near-zero and near-one values
+    if (p <= 0.0) {
+      p = EPSILION;
+    } else if (p >= 1.0) {
+      p = 1.0 - EPSILION;
     }
+    res->data[0] = -std::log(p); // not averaging it
+  };
+  forward();
+
+  if (!out->record_grad_from({logits_ptr})) {
+    return out->get(0);
   }
 
-  std::shared_ptr logits_ln = logits_softmax->get(actualIdx)->ln();
+  out->_prev = {logits};
+  out->_op = 'c';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([logits_ptr, res, actualIdx]() {
+    double max_val = 0.0;
+    double sum_exp = 0.0;
+    softmax_stats(logits_ptr->data, max_val, sum_exp);
+
+    // a clamped probability is a constant, so no gradient flows back
+    double p_t = std::exp(logits_ptr->data[actualIdx] - max_val) / sum_exp;
+    if (p_t <= 0.0 || p_t >= 1.0) {
+      return;
+    }
+
+    // d(-ln(softmax_t)) / dx_j = softmax_j - (j == t)
+    double g = res->grad[0];
+    for (size_t j = 0; j < logits_ptr->data.size(); j++) {
+      double p_j = std::exp(logits_ptr->data[j] - max_val) / sum_exp;
+      double one_hot = int(j) == actualIdx ? 1.0 : 0.0;
+      logits_ptr->grad[j] += (p_j - one_hot) * g;
+    }
+  });
+  return out->get(0);
+}
+
+// probability of the expected class, clamped away from 0 and 1
+static double bce_probability(double logit_value, int actualIdx) {
+  double updated_logit_value =
+      actualIdx == 0 ? 1.0 - logit_value : logit_value;
 
-  return logits_ln->mul(-1); // not averaging it
+  if (updated_logit_value < 0 || updated_logit_value > 1) {
+    throw std::runtime_error(
+        "logit value can't be less than 0, and more than 1. Got: " +
+        std::to_string(logit_value));
+  }
+
+  constexpr double EPSILION = 1e-6;
+  if (updated_logit_value <= 0.0) {
+    updated_logit_value = EPSILION; // Handle near-zero values
+  } else if (updated_logit_value >= 1.0) {
+    updated_logit_value = 1.0 - EPSILION; // Handle near-one values
+  }
+  return updated_logit_value;
 }
 
 std::shared_ptr<Value> binary_cross_entropy(
@@ -73,26 +178,32 @@ std::shared_ptr<Value> binary_cross_entropy(
         "logits must be a one-dimensional tensor.. Got: logits shape =>" +
         logits->tensor_shape_str());
   }
-  std::shared_ptr<Value> logit_value = logits->get(0);
+  logits = logits->contiguous();
+  // derivative of the probability w.r.t. the logit
+  double sign = actualIdx == 0 ? -1.0 : 1.0;
 
-  std::shared_ptr<Value> updated_logit_value = logit_value;
-  if (actualIdx == 0) {
-    updated_logit_value = std::make_shared<Value>(1.0)->sub(logit_value);
-  }
+  std::shared_ptr<Tensor> out =
+      make_node<Tensor>(std::vector<int>{1}, Uninitialized{});
 
-  if (updated_logit_value->data < 0 || updated_logit_value->data > 1) {
-    throw std::runtime_error(
-        "logit value can't be less than 0, and more than 1. Got: " +
-        std::to_string(logit_value->data));
-  }
+  Tensor* logits_ptr = logits.get();
+  Tensor* res = out.get();
+  auto forward = [logits_ptr, res, actualIdx]() {
+    res->data[0] = -std::log(bce_probability(logits_ptr->data[0], actualIdx));
+  };
+  forward();
 
-  constexpr double EPSILION = 1e-6;
-  if (updated_logit_value->data <= 0.0) {
-    updated_logit_value->data = EPSILION; // Handle near-zero values
-  } else if (updated_logit_value->data >= 1.0) {
-    updated_logit_value->data = 1.0 - EPSILION; // Handle near-one values
+  if (!out->record_grad_from({logits_ptr})) {
+    return out->get(0);
   }
 
-  std::shared_ptr logits_ln = updated_logit_value->ln();
-  return logits_ln->mul(-1);
+  out->_prev = {logits};
+  out->_op = 'b';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([logits_ptr, res, actualIdx, sign]() {
+    // d(-ln(p)) / dx = -(1 / p) * (dp / dx)
+    double p = bce_probability(logits_ptr->data[0], actualIdx);
+    logits_ptr->grad[0] += -(1.0 / p) * sign * res->grad[0];
+  });
+  return out->get(0);
 }
@@ -1,5 +1,14 @@
+#include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include "buffer_cache.h"
+#include "capture.h"
+#include "fusion.h"
+#include "grad_mode.h"
 #include "layers/convolutional_layer.h"
 #include "layers/linear_layer.h"
 #include "layers/flatten.h"
@@ -8,23 +17,139 @@
 #include "neural_network.h"
 #include "optimizer.h"
 #include "tensor.h"
+#include "thread_pool.h"
 #include "value.h"
 
 namespace py = pybind11;
 using overload_cast_ = pybind11::detail::overload_cast_impl<Value>;
 
+// `with no_grad():` holds a NoGradGuard for the duration of the block
+struct PyNoGrad {
+  std::optional<NoGradGuard> guard;
+};
+
+// the shape of `t`, as numpy takes it
+std::vector<py::ssize_t> numpy_shape(const Tensor& t) {
+  return std::vector<py::ssize_t>(t.shape.begin(), t.shape.end());
+}
+
+// `strides` (in elements) as numpy takes them, in bytes
+std::vector<py::ssize_t> numpy_strides(const std::vector<int>& strides) {
+  std::vector<py::ssize_t> out;
+  for (int s : strides) {
+    out.push_back(py::ssize_t(s) * py::ssize_t(sizeof(double)));
+  }
+  return out;
+}
+
+// arrays whose last tensor went away on a thread without the GIL (a worker
+// of a backward pass, which the main thread may be waiting on while it
+// holds the GIL). Never destroyed, like the BufferCache.
+struct ReleasedArrays {
+  std::mutex mutex;
+  std::vector<py::object*> arrays;
+};
+
+ReleasedArrays& released_arrays() {
+  static ReleasedArrays* released = new ReleasedArrays();
+  return *released;
+}
+
+// run by the interpreter on the main thread, with the GIL
+int drop_released_arrays(void*) {
+  std::vector<py::object*> arrays;
+  {
+    std::lock_guard<std::mutex> lock(released_arrays().mutex);
+    arrays.swap(released_arrays().arrays);
+  }
+  for (py::object* array : arrays) {
+    delete array;
+  }
+  return 0;
+}
+
+// drops the reference to `array` now if this thread holds the GIL, else
+// hands it to the main thread: waiting for the GIL here could deadlock
+void release_array(py::object* array) {
+  if (PyGILState_Check()) {
+    delete array;
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(released_arrays().mutex);
+    released_arrays().arrays.push_back(array);
+  }
+  // if the interpreter's queue is full, the next call picks this one up
+  Py_AddPendingCall(&drop_released_arrays, nullptr);
+}
+
+// keeps a storage (so its buffer) alive for as long as a numpy array over it
+py::capsule storage_owner(const Storage& storage) {
+  return py::capsule(
+      new Storage(storage.view(0, storage.size())),
+      [](void* p) { delete static_cast<Storage*>(p); });
+}
+
+// a tensor over the memory of `arr`, no copy when it's a writable float64
+// array with (positive) strides a tensor can take; otherwise over a
+// row-major float64 copy of it
+std::shared_ptr<Tensor> tensor_from_numpy(const py::array& arr) {
+  auto a = py::array_t<double>::ensure(arr);
+  if (!a) {
+    throw std::invalid_argument("from_numpy: expected a numeric array");
+  }
+  bool viewable = a.writeable();
+  for (py::ssize_t d = 0; d < a.ndim(); d++) {
+    viewable = viewable && a.strides(d) >= 0 &&
+        a.strides(d) % py::ssize_t(sizeof(double)) == 0;
+  }
+  if (!viewable) {
+    a = py::array_t<double, py::array::c_style>::ensure(a.attr("copy")());
+  }
+
+  // a 0-d array becomes a tensor of one element
+  std::vector<int> shape = {1}, strides = {1};
+  if (a.ndim() > 0) {
+    shape.assign(a.ndim(), 0);
+    strides.assign(a.ndim(), 0);
+  }
+  size_t span = 1; // elements between the first & the last, included
+  for (py::ssize_t d = 0; d < a.ndim(); d++) {
+    shape[d] = int(a.shape(d));
+    strides[d] = int(a.strides(d) / py::ssize_t(sizeof(double)));
+    if (shape[d] == 0) {
+      throw std::invalid_argument("from_numpy: array has no elements");
+    }
+    span += size_t(shape[d] - 1) * size_t(strides[d]);
+  }
+
+  // the array stays alive as long as a storage over it does
+  auto* owner = new py::object(a);
+  std::shared_ptr<double> buffer(
+      a.mutable_data(), [owner](double*) { release_array(owner); });
+  return std::make_shared<Tensor>(
+      std::move(shape), std::move(strides), Storage::wrap(buffer, span));
+}
+
 PYBIND11_MODULE(_core, m) {
   m.doc() =
       "A minimal deep learning framework made by Deependu Jha <deependujha21@gmail.com>"; // optional module docstring
   py::class_<Value, std::shared_ptr<Value>>(m, "Value")
       .def(py::init<double>())
-      .def(py::init<double, std::unordered_set<std::shared_ptr<Value>>, char>())
+      .def(py::init<double, std::vector<std::shared_ptr<Value>>, char>())
       .def_readwrite("data", &Value::data)
       .def_readwrite("grad", &Value::grad)
-      .def_readwrite("_prev", &Value::_prev)
+      .def_readwrite("requires_grad", &Value::requires_grad)
+      .def_property_readonly("_prev", &Value::prev)
       .def_readwrite("char", &Value::_op)
-      .def("backward", &Value::backward)
+      .def(
+          "backward",
+          &Value::backward,
+          "backprop, consuming the tensor graph unless retain_graph",
+          py::arg("retain_graph") = false)
       .def("executeBackward", &Value::executeBackWardMethod)
+      .def_static("sum", &Value::sum, "sum of values, as a single node")
+      .def_static("dot", &Value::dot, "dot product, as a single node")
       .def("__repr__", &Value::printMe)
       .def(
           "__add__",
@@ -94,12 +219,30 @@ PYBIND11_MODULE(_core, m) {
           "apply relu operation");
 
   // exposing tensor class
+  // no buffer protocol: the buffer would only be kept alive by the tensor,
+  // which may let go of it. numpy() is the way to the elements.
   py::class_<Tensor, std::shared_ptr<Tensor>>(m, "Tensor")
       .def(py::init<std::vector<int>>())
+      .def_static(
+          "from_numpy",
+          &tensor_from_numpy,
+          "tensor sharing the memory of a float64 array (others are copied)",
+          py::arg("array"))
+      .def(
+          "numpy",
+          [](std::shared_ptr<Tensor> t) {
+            // the array holds the buffer, even if the tensor gets a new one
+            return py::array_t<double>(
+                numpy_shape(*t),
+                numpy_strides(t->strides),
+                t->data.data(),
+                storage_owner(t->data));
+          },
+          "array sharing the memory of this tensor")
       .def(
           "set",
           static_cast<void (Tensor::*)(
-              std::vector<int>, std::shared_ptr<Value>)>(&Tensor::set))
+              const std::vector<int>&, std::shared_ptr<Value>)>(&Tensor::set))
       .def(
           "set",
           static_cast<void (Tensor::*)(int, std::shared_ptr<Value>)>(
@@ -109,27 +252,145 @@ PYBIND11_MODULE(_core, m) {
           static_cast<std::shared_ptr<Value> (Tensor::*)(int)>(&Tensor::get))
       .def(
           "get",
-          static_cast<std::shared_ptr<Value> (Tensor::*)(std::vector<int>)>(
-              &Tensor::get))
+          static_cast<std::shared_ptr<Value> (Tensor::*)(
+              const std::vector<int>&)>(&Tensor::get))
       .def_readonly("shape", &Tensor::shape)
       .def_readonly("strides", &Tensor::strides)
       .def_readonly("maxIdx", &Tensor::maxIdx)
       .def_readonly("minIdx", &Tensor::minIdx)
-      .def_readonly("vals", &Tensor::v)
+      .def_readwrite("requires_grad", &Tensor::requires_grad)
+      .def_property_readonly(
+          "vals",
+          [](std::shared_ptr<Tensor> t) {
+            std::vector<std::shared_ptr<Value>> out;
+            for (int i = 0; i <= t->maxIdx; i++) {
+              out.push_back(t->get(i));
+            }
+            return out;
+          })
+      .def_property_readonly(
+          "grad",
+          [](std::shared_ptr<Tensor> t) -> py::object {
+            if (t->grad.empty()) {
+              return py::none(); // before backward
+            }
+            // row-major; the array holds the buffer, like numpy() does
+            return py::array_t<double>(
+                numpy_shape(*t), t->grad.data(), storage_owner(t->grad));
+          },
+          "array sharing the memory of the gradient (None before backward)")
       .def("normalize_idx", &Tensor::normalize_idx)
       .def("zero_grad", &Tensor::zero_grad)
-      .def("reshape", &Tensor::reshape)
+      .def(
+          "backward",
+          static_cast<void (Tensor::*)(bool)>(&Tensor::backward),
+          "backprop with a gradient of ones for every element",
+          py::arg("retain_graph") = true)
+      .def("is_contiguous", &Tensor::is_contiguous)
+      .def("contiguous", &Tensor::contiguous, "row-major copy, unless already")
+      .def("reshape", &Tensor::reshape, "view with a new shape")
+      .def("flatten", &Tensor::flatten, "1-D view")
+      .def("transpose", &Tensor::transpose, "view with two dims swapped")
+      .def("permute", &Tensor::permute, "view with the dims reordered")
+      .def(
+          "slice",
+          &Tensor::slice,
+          "view of elements [start, end) of a dim",
+          py::arg("dim"),
+          py::arg("start"),
+          py::arg("end"),
+          py::arg("step") = 1)
+      .def(
+          "squeeze",
+          static_cast<std::shared_ptr<Tensor> (Tensor::*)()>(&Tensor::squeeze),
+          "view without the dims of size 1")
+      .def(
+          "squeeze",
+          static_cast<std::shared_ptr<Tensor> (Tensor::*)(int)>(
+              &Tensor::squeeze),
+          "view without a dim of size 1")
+      .def("unsqueeze", &Tensor::unsqueeze, "view with a new dim of size 1")
       .def("__add__", &Tensor::add)
-      .def("__truediv__", &Tensor::div)
+      .def("__sub__", &Tensor::sub)
+      .def("__mul__", &Tensor::mul)
+      .def(
+          "__truediv__",
+          static_cast<std::shared_ptr<Tensor> (Tensor::*)(
+              std::shared_ptr<Tensor>)>(&Tensor::div))
+      .def(
+          "__truediv__",
+          static_cast<std::shared_ptr<Tensor> (Tensor::*)(
+              std::shared_ptr<Value>)>(&Tensor::div))
+      .def("maximum", &Tensor::maximum, "elementwise max, with broadcasting")
       .def("matmul", &Tensor::matmul)
       .def("relu", &Tensor::relu)
       .def("gelu", &Tensor::gelu)
       .def("sigmoid", &Tensor::sigmoid)
       .def("tanh", &Tensor::tanh)
       .def("leakyRelu", &Tensor::leakyRelu)
-      .def("softmax", &Tensor::softmax)
+      .def(
+          "softmax",
+          static_cast<std::shared_ptr<Tensor> (Tensor::*)()>(&Tensor::softmax),
+          "softmax over the whole tensor")
+      .def(
+          "softmax",
+          static_cast<std::shared_ptr<Tensor> (Tensor::*)(int)>(
+              &Tensor::softmax),
+          "softmax along a dim",
+          py::arg("dim"))
+      .def(
+          "log_softmax",
+          &Tensor::log_softmax,
+          "log of the softmax along a dim",
+          py::arg("dim"))
+      .def(
+          "sum",
+          &Tensor::sum,
+          "sum over dims (all if empty)",
+          py::arg("dims") = std::vector<int>{},
+          py::arg("keepdim") = false)
+      .def(
+          "mean",
+          &Tensor::mean,
+          "mean over dims (all if empty)",
+          py::arg("dims") = std::vector<int>{},
+          py::arg("keepdim") = false)
+      .def(
+          "max",
+          &Tensor::max,
+          "max over dims (all if empty)",
+          py::arg("dims") = std::vector<int>{},
+          py::arg("keepdim") = false)
+      .def(
+          "argmax",
+          &Tensor::argmax,
+          "index of the max within dims (all if empty)",
+          py::arg("dims") = std::vector<int>{},
+          py::arg("keepdim") = false)
+      .def(
+          "var",
+          &Tensor::var,
+          "variance over dims (all if empty)",
+          py::arg("dims") = std::vector<int>{},
+          py::arg("keepdim") = false,
+          py::arg("correction") = 1)
+      .def("lazy", &Tensor::lazy, "elementwise ops that run fused")
       .def("__repr__", &Tensor::printMe);
 
+  //   fused elementwise chains
+  py::class_<LazyTensor, std::shared_ptr<LazyTensor>>(m, "LazyTensor")
+      .def(py::init<std::shared_ptr<Tensor>>())
+      .def("relu", &LazyTensor::relu)
+      .def("gelu", &LazyTensor::gelu)
+      .def("sigmoid", &LazyTensor::sigmoid)
+      .def("tanh", &LazyTensor::tanh)
+      .def("leakyRelu", &LazyTensor::leakyRelu)
+      .def("add", &LazyTensor::add)
+      .def("mul", &LazyTensor::mul)
+      .def("materialize", &LazyTensor::materialize)
+      .def_property_readonly("shape", &LazyTensor::shape)
+      .def("__len__", &LazyTensor::size);
+
   //   exposing Layer class
   py::class_<Layer, std::shared_ptr<Layer>>(m, "Layer")
       .def("zero_grad", &Layer::zero_grad)
@@ -219,6 +480,7 @@ PYBIND11_MODULE(_core, m) {
       .def(py::init<std::vector<std::shared_ptr<Layer>>, bool>())
       .def_readwrite("using_cuda", &Model::using_cuda)
       .def_readwrite("layers", &Model::layers)
+      .def_readwrite("checkpoint_every", &Model::checkpoint_every)
       .def("zero_grad", &Model::zero_grad)
       .def("save_model", &Model::save_model)
       .def("load_model", &Model::load_model)
@@ -277,4 +539,67 @@ PYBIND11_MODULE(_core, m) {
       "binary_cross_entropy",
       &binary_cross_entropy,
       "A function that value object with cross_entropy applied");
+
+  //   captured training step
+  py::class_<CapturedStep, std::shared_ptr<CapturedStep>>(m, "CapturedStep")
+      .def(py::init<
+           const std::shared_ptr<Model>&,
+           std::shared_ptr<Tensor>,
+           std::shared_ptr<Tensor>,
+           const CapturedStep::LossFn&>())
+      .def(
+          "replay",
+          static_cast<double (CapturedStep::*)()>(&CapturedStep::replay),
+          "rerun with the data already in the input & target tensors")
+      .def(
+          "replay",
+          static_cast<double (CapturedStep::*)(
+              const std::vector<double>&, const std::vector<double>&)>(
+              &CapturedStep::replay),
+          "copy new input & target data in, then rerun")
+      .def_property_readonly("input", &CapturedStep::input)
+      .def_property_readonly("target", &CapturedStep::target)
+      .def_property_readonly("output", &CapturedStep::output)
+      .def_property_readonly("loss", &CapturedStep::loss)
+      .def("__len__", &CapturedStep::size);
+
+  //   inference mode
+  py::class_<PyNoGrad>(m, "no_grad")
+      .def(py::init<>())
+      .def("__enter__", [](PyNoGrad& self) { self.guard.emplace(); })
+      .def(
+          "__exit__",
+          [](PyNoGrad& self, py::args) { self.guard.reset(); },
+          "restores the previous grad mode");
+  m.def("is_grad_enabled", &GradMode::is_enabled);
+  m.def("set_grad_enabled", &GradMode::set_enabled);
+
+  //   intra-op threads
+  m.def(
+      "set_num_threads",
+      &set_num_threads,
+      "threads used by tensor ops and backward (0: one per core)");
+  m.def("get_num_threads", &get_num_threads);
+
+  //   tensor buffer cache
+  m.def(
+      "buffer_cache_stats",
+      []() {
+        BufferCache::Stats stats = BufferCache::global().stats();
+        py::dict out;
+        out["hits"] = stats.hits;
+        out["misses"] = stats.misses;
+        out["bytes_cached"] = stats.bytes_cached;
+        out["buffers_cached"] = stats.buffers_cached;
+        return out;
+      },
+      "hits, misses and what's cached of the tensor buffer cache");
+  m.def(
+      "empty_buffer_cache",
+      []() { BufferCache::global().empty(); },
+      "frees the cached tensor buffers");
+  m.def(
+      "set_buffer_cache_limit",
+      [](size_t bytes) { BufferCache::global().set_limit(bytes); },
+      "bytes the tensor buffer cache keeps at most (0: no caching)");
 }
@@ -1,9 +1,13 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
+#include "arena.h"
+#include "fusion.h"
+#include "grad_mode.h"
 #include "tensor.h"
 
 class Layer {
@@ -14,28 +18,146 @@ public:
       std::shared_ptr<Tensor> input,
       bool using_cuda) = 0;
 
+  // the layer as elementwise ops appended to `input` (the unrun output of
+  // the layers before it), so Model runs them fused with their neighbours.
+  // nullptr, with `input` untouched, if the layer isn't elementwise.
+  virtual std::shared_ptr<LazyTensor> call_lazy(
+      std::shared_ptr<LazyTensor> /*input*/) {
+    return nullptr;
+  }
+
   virtual std::string printMe() = 0;
 
-  virtual std::vector<std::shared_ptr<Value>> parameters() {
+  virtual std::vector<std::shared_ptr<Tensor>> parameters() {
     // no parameters
-    return std::vector<std::shared_ptr<Value>>{};
+    return std::vector<std::shared_ptr<Tensor>>{};
   }
 
   virtual void zero_grad() = 0;
 };
 
 class Model {
+private:
+  static std::shared_ptr<Tensor> call_layers(
+      const std::vector<std::shared_ptr<Layer>>& layers,
+      std::shared_ptr<Tensor> input,
+      bool using_cuda) {
+    // runs of elementwise layers are fused: their ops pile up in `pending`
+    // and run in one pass when a layer needs a real tensor
+    std::shared_ptr<Tensor> out = std::move(input);
+    std::shared_ptr<LazyTensor> pending = nullptr;
+    for (auto& e : layers) {
+      std::shared_ptr<LazyTensor> chain =
+          e->call_lazy(pending != nullptr ? pending : out->lazy());
+      if (chain != nullptr) {
+        pending = chain;
+        continue;
+      }
+      if (pending != nullptr) {
+        out = pending->materialize();
+        pending = nullptr;
+      }
+      out = e->call(out, using_cuda);
+    }
+    return pending != nullptr ? pending->materialize() : out;
+  }
+
+  // Runs `segment` without recording a graph, so its interior activations
+  // are freed right away. The output is a single node whose backward runs
+  // the segment again (with the graph) and backprops through it.
+  std::shared_ptr<Tensor> call_checkpointed(
+      std::vector<std::shared_ptr<Layer>> segment,
+      std::shared_ptr<Tensor> input) {
+    input = input->contiguous();
+    std::shared_ptr<Tensor> seg_out;
+    {
+      NoGradGuard no_grad;
+      seg_out = call_layers(segment, input, this->using_cuda);
+    }
+    std::shared_ptr<Tensor> out =
+        make_node<Tensor>(seg_out->shape, Uninitialized{});
+    if (seg_out == input) {
+      out->data = seg_out->data;
+    } else {
+      out->data = std::move(seg_out->data);
+    }
+    seg_out.reset();
+
+    out->requires_grad = input->requires_grad;
+    for (auto& layer : segment) {
+      for (auto& p : layer->parameters()) {
+        out->requires_grad = out->requires_grad || p->requires_grad;
+      }
+    }
+    if (!out->requires_grad && !GradMode::is_capturing()) {
+      return out;
+    }
+
+    // parameters are leaves, reached by the inner backward. They're inputs
+    // all the same, so the backward pass locks their grads around it (two
+    // checkpoints of the same layers can't accumulate at once).
+    out->_prev = {input};
+    for (auto& layer : segment) {
+      for (auto& p : layer->parameters()) {
+        out->_prev.push_back(p);
+      }
+    }
+    out->_op = 'K';
+
+    Tensor* input_ptr = input.get();
+    Tensor* res = out.get();
+    bool using_cuda = this->using_cuda;
+    out->setForwardMethod([segment, input_ptr, res, using_cuda]() {
+      NoGradGuard no_grad;
+      std::shared_ptr<Tensor> x = std::make_shared<Tensor>(input_ptr->shape);
+      x->data = input_ptr->data;
+      std::shared_ptr<Tensor> y = call_layers(segment, x, using_cuda);
+      std::copy(y->data.begin(), y->data.end(), res->data.begin());
+    });
+    out->setBackWardMethod([segment, input_ptr, res, using_cuda]() {
+      EnableGradGuard enable_grad;
+      std::shared_ptr<Tensor> x = std::make_shared<Tensor>(input_ptr->shape);
+      x->data = input_ptr->data;
+      x->requires_grad = input_ptr->requires_grad;
+      std::shared_ptr<Tensor> y = call_layers(segment, x, using_cuda);
+      Tensor::backward({y}, {res->grad.to_vector()});
+      if (input_ptr->requires_grad) {
+        // other consumers of the input may be accumulating too
+        GradLock lock({input_ptr});
+        for (size_t i = 0; i < x->grad.size(); i++) {
+          input_ptr->grad[i] += x->grad[i];
+        }
+      }
+    });
+    return out;
+  }
+
 public:
   bool using_cuda = false;
   std::vector<std::shared_ptr<Layer>> layers;
 
+  // gradient checkpointing: with N > 0, the layers run in segments of N and
+  // only the output of each segment is kept for backward; the activations
+  // inside a segment are recomputed during backward. Trades compute for
+  // memory.
+  int checkpoint_every = 0;
+
   Model(std::vector<std::shared_ptr<Layer>> layers, bool using_cuda)
       : layers(std::move(layers)), using_cuda(using_cuda) {}
 
   std::shared_ptr<Tensor> call(std::shared_ptr<Tensor> input) {
-    std::shared_ptr<Tensor> out = input;
-    for (auto& e : this->layers) {
-      out = e->call(out, this->using_cuda);
+    if (this->checkpoint_every <= 0 || !GradMode::is_enabled()) {
+      return call_layers(this->layers, std::move(input), this->using_cuda);
+    }
+
+    std::shared_ptr<Tensor> out = std::move(input);
+    size_t n = this->checkpoint_every;
+    for (size_t start = 0; start < this->layers.size(); start += n) {
+      size_t end = std::min(start + n, this->layers.size());
+      out = call_checkpointed(
+          std::vector<std::shared_ptr<Layer>>(
+              this->layers.begin() + start, this->layers.begin() + end),
+          out);
     }
     return out;
   }
@@ -57,10 +179,10 @@ public:
     return s;
   }
 
-  std::vector<std::shared_ptr<Value>> parameters() {
-    std::vector<std::shared_ptr<Value>> out;
+  std::vector<std::shared_ptr<Tensor>> parameters() {
+    std::vector<std::shared_ptr<Tensor>> out;
     for (auto& e : this->layers) {
-      std::vector<std::shared_ptr<Value>> curr = e->parameters();
+      std::vector<std::shared_ptr<Tensor>> curr = e->parameters();
       out.insert(out.end(), curr.begin(), curr.end());
     }
     return out;
@@ -3,13 +3,26 @@
 #include <memory>
 #include <utility>
 #include <vector>
+#include "arena.h"
 #include "neural_network.h"
 
 class Optimizer {
 public:
   virtual ~Optimizer() = default;
+  // updates the parameters, then rewinds the node arena of this thread (a
+  // no-op while nodes of the last step are still alive)
   virtual void step() = 0;
   virtual void zero_grad() = 0;
+
+protected:
+  // total no. of scalar parameters, used to size the per-element state
+  static size_t parameter_count(const std::shared_ptr<Model>& m) {
+    size_t n = 0;
+    for (auto& p : m->parameters()) {
+      n += p->data.size();
+    }
+    return n;
+  }
 };
 
 // stochastic gradient descent
@@ -23,10 +36,15 @@ public:
       : m(std::move(m)), learning_rate(learning_rate) {}
 
   void step() override {
-    const auto& m_para = this->m->parameters();
-    for (auto& e : m_para) {
-      e->data = e->data - this->learning_rate * e->grad;
+    for (auto& p : this->m->parameters()) {
+      if (p->grad.empty()) {
+        continue; // never backpropagated into
+      }
+      for (size_t j = 0; j < p->data.size(); j++) {
+        p->data[j] = p->data[j] - this->learning_rate * p->grad[j];
+      }
     }
+    Arena::current().reset();
   }
 
   void zero_grad() override {
@@ -50,15 +68,22 @@ public:
       : m(std::move(m)),
         learning_rate(learning_rate),
         decay_factor(decay_factor) {
-    velocity.resize(m->parameters().size(), 0);
+    velocity.resize(parameter_count(this->m), 0);
   }
 
   void step() override {
-    const auto& m_para = this->m->parameters();
-    for (int i = 0; i < m_para.size(); i++) {
-      velocity[i] = this->decay_factor * velocity[i] + m_para[i]->grad;
-      m_para[i]->data = m_para[i]->data - this->learning_rate * velocity[i];
+    size_t i = 0; // index into the flattened parameters
+    for (auto& p : this->m->parameters()) {
+      if (p->grad.empty()) {
+        i += p->data.size();
+        continue;
+      }
+      for (size_t j = 0; j < p->data.size(); j++, i++) {
+        velocity[i] = this->decay_factor * velocity[i] + p->grad[j];
+        p->data[j] = p->data[j] - this->learning_rate * velocity[i];
+      }
     }
+    Arena::current().reset();
   }
 
   void zero_grad() override {
@@ -114,18 +139,24 @@ public:
 
   explicit AdaGrad(std::shared_ptr<Model> m, double learning_rate)
       : m(std::move(m)), learning_rate(learning_rate) {
-    prev_grad_square.resize(m->parameters().size(), 0);
+    prev_grad_square.resize(parameter_count(this->m), 0);
   }
 
   void step() override {
-    const auto& m_para = this->m->parameters();
-    for (int i = 0; i < m_para.size(); i++) {
-      prev_grad_square[i] =
-          prev_grad_square[i] + (m_para[i]->grad * m_para[i]->grad);
-      m_para[i]->data = m_para[i]->data -
-          (this->learning_rate * m_para[i]->grad) /
-              std::sqrt(prev_grad_square[i] + this->epsilon);
+    size_t i = 0; // index into the flattened parameters
+    for (auto& p : this->m->parameters()) {
+      if (p->grad.empty()) {
+        i += p->data.size();
+        continue;
+      }
+      for (size_t j = 0; j < p->data.size(); j++, i++) {
+        prev_grad_square[i] = prev_grad_square[i] + (p->grad[j] * p->grad[j]);
+        p->data[j] = p->data[j] -
+            (this->learning_rate * p->grad[j]) /
+                std::sqrt(prev_grad_square[i] + this->epsilon);
+      }
     }
+    Arena::current().reset();
   }
 
   void zero_grad() override {
@@ -140,7 +171,7 @@ class RMSprop : public Optimizer {
   double epsilon = 1e-8;
 
   void _initialize() {
-    prev_grad_square.resize(m->parameters().size(), 0.0);
+    prev_grad_square.resize(parameter_count(this->m), 0.0);
   }
 
 public:
@@ -153,22 +184,33 @@ public:
       double decay_factor)
       : m(std::move(m)),
         learning_rate(learning_rate),
-        decay_factor(decay_factor) {}
+        decay_factor(decay_factor) {
+    _initialize();
+  }
   explicit RMSprop(std::shared_ptr<Model> m, double learning_rate)
-      : m(std::move(m)), learning_rate(learning_rate) {}
+      : m(std::move(m)), learning_rate(learning_rate) {
+    _initialize();
+  }
 
   void step() override {
-    const auto& m_para = this->m->parameters();
-    for (size_t i = 0; i < m_para.size(); i++) {
-      // Update moving average of squared gradients
-      prev_grad_square[i] = decay_factor * prev_grad_square[i] +
-          (1 - decay_factor) * (m_para[i]->grad * m_para[i]->grad);
-
-      // Update parameter
-      m_para[i]->data = m_para[i]->data -
-          (learning_rate * m_para[i]->grad) /
-              std::sqrt(prev_grad_square[i] + epsilon);
+    size_t i = 0; // index into the flattened parameters
+    for (auto& p : this->m->parameters()) {
+      if (p->grad.empty()) {
+        i += p->data.size();
+        continue;
+      }
+      for (size_t j = 0; j < p->data.size(); j++, i++) {
+        // Update moving average of squared gradients
+        prev_grad_square[i] = decay_factor * prev_grad_square[i] +
+            (1 - decay_factor) * (p->grad[j] * p->grad[j]);
+
+        // Update parameter
+        p->data[j] = p->data[j] -
+            (learning_rate * p->grad[j]) /
+                std::sqrt(prev_grad_square[i] + epsilon);
+      }
     }
+    Arena::current().reset();
   }
 
   void zero_grad() override {
@@ -186,8 +228,8 @@ class Adam : public Optimizer {
   int time = 1;
 
   void _initialize() {
-    this->prev_grad_square.resize(m->parameters().size(), 0.0);
-    this->velocity.resize(m->parameters().size(), 0.0);
+    this->prev_grad_square.resize(parameter_count(this->m), 0.0);
+    this->velocity.resize(parameter_count(this->m), 0.0);
   }
 
 public:
@@ -217,24 +259,32 @@ public:
     double bias_correction1 = 1 - pow(beta1, time);
     double bias_correction2 = 1 - pow(beta2, time);
 
-    for (size_t i = 0; i < m_para.size(); i++) {
-      // Update moving average of velocity
-      velocity[i] = beta1 * velocity[i] + (1 - beta1) * (m_para[i]->grad);
-      // Update moving average of squared gradients
-      prev_grad_square[i] = beta2 * prev_grad_square[i] +
-          (1 - beta2) * (m_para[i]->grad * m_para[i]->grad);
-
-      //   perform bias correction (to fix bias introduced introduced at t=0 due
-      //   to taking v=0 and sq_grad = 0)
-      double corrected_velocity = velocity[i] / bias_correction1;
-      double corrected_grad_square = prev_grad_square[i] / bias_correction2;
-
-      // Update parameter
-      m_para[i]->data = m_para[i]->data -
-          (learning_rate * corrected_velocity) /
-              std::sqrt(corrected_grad_square + epsilon);
+    size_t i = 0; // index into the flattened parameters
+    for (auto& p : m_para) {
+      if (p->grad.empty()) {
+        i += p->data.size();
+        continue;
+      }
+      for (size_t j = 0; j < p->data.size(); j++, i++) {
+        // Update moving average of velocity
+        velocity[i] = beta1 * velocity[i] + (1 - beta1) * (p->grad[j]);
+        // Update moving average of squared gradients
+        prev_grad_square[i] = beta2 * prev_grad_square[i] +
+            (1 - beta2) * (p->grad[j] * p->grad[j]);
+
+        //   perform bias correction (to fix bias introduced introduced at t=0
+        //   due to taking v=0 and sq_grad = 0)
+        double corrected_velocity = velocity[i] / bias_correction1;
+        double corrected_grad_square = prev_grad_square[i] / bias_correction2;
+
+        // Update parameter
+        p->data[j] = p->data[j] -
+            (learning_rate * corrected_velocity) /
+                std::sqrt(corrected_grad_square + epsilon);
+      }
     }
     this->time++;
+    Arena::current().reset();
   }
 
   void zero_grad() override {
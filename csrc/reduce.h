@@ -0,0 +1,94 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "thread_pool.h"
+
+/// Sums for reductions
+/// Summing n values one after the other lets the rounding error grow like
+/// n; halving the range recursively (pairwise) makes it grow like log(n),
+/// for the same number of additions. `tree_sum` also splits the range
+/// between the intra-op threads, in blocks of a fixed size, so the result
+/// doesn't depend on the number of threads.
+
+// elements summed one after the other at the leaves of the tree
+constexpr size_t kPairwiseLeaf = 64;
+
+// elements of a block of `tree_sum`, and the elements a thread takes
+constexpr size_t kReduceBlock = 1 << 14;
+
+// sum of at(j) for j in [lo, hi), pairwise
+template <class At>
+double pairwise_sum(size_t lo, size_t hi, const At& at) {
+  if (hi - lo <= kPairwiseLeaf) {
+    // a few independent sums, for the pipeline
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    size_t j = lo;
+    for (; j + 4 <= hi; j += 4) {
+      s0 += at(j);
+      s1 += at(j + 1);
+      s2 += at(j + 2);
+      s3 += at(j + 3);
+    }
+    for (; j < hi; j++) {
+      s0 += at(j);
+    }
+    return (s0 + s1) + (s2 + s3);
+  }
+  size_t mid = lo + (hi - lo) / 2;
+  return pairwise_sum(lo, mid, at) + pairwise_sum(mid, hi, at);
+}
+
+// sum of at(j) for j in [0, n): blocks in parallel, each pairwise, then the
+// block sums pairwise
+template <class At>
+double tree_sum(size_t n, const At& at) {
+  size_t blocks = (n + kReduceBlock - 1) / kReduceBlock;
+  if (blocks <= 1) {
+    return pairwise_sum(0, n, at);
+  }
+  std::vector<double> partial(blocks);
+  parallel_for(0, blocks, 1, [&](size_t lo, size_t hi) {
+    for (size_t b = lo; b < hi; b++) {
+      partial[b] = pairwise_sum(
+          b * kReduceBlock, std::min(n, (b + 1) * kReduceBlock), at);
+    }
+  });
+  return pairwise_sum(0, blocks, [&](size_t b) { return partial[b]; });
+}
+
+// j in [0, n) of the largest at(j), the first one on ties. Blocks in
+// parallel, as for `tree_sum`.
+template <class At>
+size_t argmax_of(size_t n, const At& at) {
+  auto scan = [&](size_t lo, size_t hi) {
+    size_t best = lo;
+    double best_val = at(lo);
+    for (size_t j = lo + 1; j < hi; j++) {
+      double v = at(j);
+      if (v > best_val) {
+        best = j;
+        best_val = v;
+      }
+    }
+    return best;
+  };
+  size_t blocks = (n + kReduceBlock - 1) / kReduceBlock;
+  if (blocks <= 1) {
+    return scan(0, n);
+  }
+  std::vector<size_t> partial(blocks);
+  parallel_for(0, blocks, 1, [&](size_t lo, size_t hi) {
+    for (size_t b = lo; b < hi; b++) {
+      partial[b] =
+          scan(b * kReduceBlock, std::min(n, (b + 1) * kReduceBlock));
+    }
+  });
+  size_t best = partial[0];
+  for (size_t b = 1; b < blocks; b++) {
+    if (at(partial[b]) > at(best)) {
+      best = partial[b];
+    }
+  }
+  return best;
+}
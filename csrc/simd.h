@@ -0,0 +1,25 @@
+#pragma once
+
+// x86 kernels are compiled with target attributes and picked at runtime,
+// so the build doesn't need -march flags
+#if defined(__GNUC__) && defined(__x86_64__)
+#define DEEPTENSOR_X86_KERNELS 1
+#endif
+
+// whether the CPU we run on has AVX2 and FMA
+inline bool cpu_has_avx2() {
+#ifdef DEEPTENSOR_X86_KERNELS
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+  return false;
+#endif
+}
+
+// whether the CPU we run on has AVX-512F
+inline bool cpu_has_avx512() {
+#ifdef DEEPTENSOR_X86_KERNELS
+  return __builtin_cpu_supports("avx512f");
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "buffer_cache.h"
+
+/// Storage
+/// The elements a tensor reads. The buffer behind it can be shared: a view
+/// (transpose, slice, ...) gets a Storage over the same buffer, starting at
+/// an offset, so making it copies nothing.
+///
+/// Buffers come from the BufferCache, and go back to it when the last
+/// Storage over them is gone, so the buffer may be larger than `size`.
+/// `wrap` makes a Storage over memory owned elsewhere (a NumPy array), kept
+/// alive by the deleter it comes with.
+///
+/// Cached buffers aren't initialized: `Storage(n)` fills its elements, a
+/// Storage made with `Uninitialized` leaves them for its owner to write.
+///
+/// Otherwise it behaves like the vector it replaces: copying a Storage (or
+/// assigning to it) copies elements, only `view` shares. Assigning the same
+/// number of elements writes them in place, so it writes through a view.
+// tag for a Storage (or Tensor) whose elements are all written by its
+// owner before they're read
+struct Uninitialized {};
+
+class Storage {
+private:
+  std::shared_ptr<double> buffer_ = nullptr; // first element of the buffer
+  size_t offset_ = 0; // first element, in the buffer
+  size_t size_ = 0;
+
+  // a buffer of the cache, as a pointer to its elements that owns it
+  static std::shared_ptr<double> cached_buffer(size_t n) {
+    std::shared_ptr<BufferCache::Buffer> buffer =
+        BufferCache::global().acquire(n);
+    double* first = buffer->data();
+    return std::shared_ptr<double>(std::move(buffer), first);
+  }
+
+  template <class It>
+  void copy_from(It first, It last) {
+    size_t n = std::distance(first, last);
+    if (this->buffer_ != nullptr && n == this->size_) {
+      std::copy(first, last, this->begin());
+      return;
+    }
+    this->buffer_ = cached_buffer(n);
+    this->offset_ = 0;
+    this->size_ = n;
+    std::copy(first, last, this->begin());
+  }
+
+public:
+  Storage() = default;
+
+  explicit Storage(size_t n, double value = 0.0)
+      : buffer_(cached_buffer(n)), size_(n) {
+    std::fill(this->begin(), this->end(), value);
+  }
+
+  Storage(size_t n, Uninitialized) : buffer_(cached_buffer(n)), size_(n) {}
+
+  Storage(std::initializer_list<double> values) {
+    this->copy_from(values.begin(), values.end());
+  }
+
+  Storage(const std::vector<double>& values) {
+    this->copy_from(values.begin(), values.end());
+  }
+
+  Storage(const Storage& other) {
+    this->copy_from(other.begin(), other.end());
+  }
+
+  Storage(Storage&& other) noexcept = default;
+
+  Storage& operator=(const Storage& other) {
+    if (this != &other) {
+      this->copy_from(other.begin(), other.end());
+    }
+    return *this;
+  }
+
+  Storage& operator=(Storage&& other) noexcept = default;
+
+  Storage& operator=(std::initializer_list<double> values) {
+    this->copy_from(values.begin(), values.end());
+    return *this;
+  }
+
+  Storage& operator=(const std::vector<double>& values) {
+    this->copy_from(values.begin(), values.end());
+    return *this;
+  }
+
+  // `size` elements at `buffer`, not copied: the storage shares ownership
+  // of them (and its views do too)
+  static Storage wrap(std::shared_ptr<double> buffer, size_t size) {
+    Storage out;
+    out.buffer_ = std::move(buffer);
+    out.size_ = size;
+    return out;
+  }
+
+  // `n` elements equal to `value`
+  void assign(size_t n, double value) {
+    if (this->buffer_ == nullptr || n != this->size_) {
+      *this = Storage(n, value);
+      return;
+    }
+    std::fill(this->begin(), this->end(), value);
+  }
+
+  // `n` elements: the first ones are kept, new ones equal to `value`. The
+  // same number of elements keeps the buffer.
+  void resize(size_t n, double value) {
+    if (this->buffer_ != nullptr && n == this->size_) {
+      return;
+    }
+    Storage out(n, value);
+    std::copy(
+        this->begin(), this->begin() + std::min(n, this->size_), out.begin());
+    *this = std::move(out);
+  }
+
+  // let go of the buffer (other views of it keep it alive)
+  void clear() {
+    this->buffer_ = nullptr;
+    this->offset_ = 0;
+    this->size_ = 0;
+  }
+
+  // `size` elements of this storage, from `offset`, sharing the buffer
+  Storage view(size_t offset, size_t size) const {
+    Storage out;
+    out.buffer_ = this->buffer_;
+    out.offset_ = this->offset_ + offset;
+    out.size_ = size;
+    return out;
+  }
+
+  bool shares_buffer(const Storage& other) const {
+    return this->buffer_ != nullptr && this->buffer_ == other.buffer_;
+  }
+
+  size_t offset() const {
+    return this->offset_;
+  }
+
+  size_t size() const {
+    return this->size_;
+  }
+
+  bool empty() const {
+    return this->size_ == 0;
+  }
+
+  double* data() {
+    return this->buffer_ == nullptr ? nullptr
+                                    : this->buffer_.get() + this->offset_;
+  }
+
+  const double* data() const {
+    return this->buffer_ == nullptr ? nullptr
+                                    : this->buffer_.get() + this->offset_;
+  }
+
+  double* begin() {
+    return this->data();
+  }
+
+  double* end() {
+    return this->data() + this->size_;
+  }
+
+  const double* begin() const {
+    return this->data();
+  }
+
+  const double* end() const {
+    return this->data() + this->size_;
+  }
+
+  double& operator[](size_t i) {
+    return this->buffer_.get()[this->offset_ + i];
+  }
+
+  const double& operator[](size_t i) const {
+    return this->buffer_.get()[this->offset_ + i];
+  }
+
+  bool operator==(const Storage& other) const {
+    return std::equal(this->begin(), this->end(), other.begin(), other.end());
+  }
+
+  bool operator==(const std::vector<double>& other) const {
+    return std::equal(this->begin(), this->end(), other.begin(), other.end());
+  }
+
+  // elements as a vector (a copy)
+  std::vector<double> to_vector() const {
+    return std::vector<double>(this->begin(), this->end());
+  }
+};
@@ -0,0 +1,131 @@
+#pragma once
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+/// StridedCursor
+/// Walks the elements of a tensor laid out by `shape` & `strides`, in
+/// row-major order, keeping their position in the storage like an odometer:
+/// a step bumps the last dim and carries into the previous ones. So a step
+/// is an add (and a carry now and then), never a division or an allocation.
+/// `shape` & `strides` are borrowed, they have to outlive the cursor.
+class StridedCursor {
+private:
+  const int* shape_;
+  const int* strides_;
+  int rank_;
+  std::vector<int> idx_;
+  int pos_ = 0;
+
+public:
+  StridedCursor(const std::vector<int>& shape, const std::vector<int>& strides)
+      : shape_(shape.data()),
+        strides_(strides.data()),
+        rank_(int(shape.size())),
+        idx_(shape.size(), 0) {}
+
+  // position in the storage of the current element
+  int pos() const {
+    return this->pos_;
+  }
+
+  // index of the current element, one entry per dim
+  const std::vector<int>& index() const {
+    return this->idx_;
+  }
+
+  void next() {
+    for (int d = this->rank_ - 1; d >= 0; d--) {
+      this->pos_ += this->strides_[d];
+      if (++this->idx_[d] < this->shape_[d]) {
+        return;
+      }
+      this->pos_ -= this->strides_[d] * this->shape_[d];
+      this->idx_[d] = 0;
+    }
+  }
+};
+
+/// StridedRange
+/// The elements of a tensor in row-major order, for a range-for:
+///   for (double& v : t->elements()) { ... }
+/// walks a (non contiguous) view in the order its index runs.
+template <class T>
+class StridedRange {
+private:
+  T* base_;
+  const std::vector<int>* shape_;
+  const std::vector<int>* strides_;
+  size_t size_;
+
+public:
+  class iterator {
+  private:
+    T* base_;
+    StridedCursor cursor_;
+    size_t i_;
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::remove_const_t<T>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T*;
+    using reference = T&;
+
+    iterator(
+        T* base,
+        const std::vector<int>& shape,
+        const std::vector<int>& strides,
+        size_t i)
+        : base_(base), cursor_(shape, strides), i_(i) {}
+
+    T& operator*() const {
+      return this->base_[this->cursor_.pos()];
+    }
+
+    iterator& operator++() {
+      this->cursor_.next();
+      this->i_++;
+      return *this;
+    }
+
+    // row-major index of the current element
+    size_t flat_index() const {
+      return this->i_;
+    }
+
+    const std::vector<int>& index() const {
+      return this->cursor_.index();
+    }
+
+    bool operator==(const iterator& other) const {
+      return this->i_ == other.i_;
+    }
+
+    bool operator!=(const iterator& other) const {
+      return this->i_ != other.i_;
+    }
+  };
+
+  StridedRange(
+      T* base,
+      const std::vector<int>& shape,
+      const std::vector<int>& strides,
+      size_t size)
+      : base_(base), shape_(&shape), strides_(&strides), size_(size) {}
+
+  iterator begin() const {
+    return iterator(this->base_, *this->shape_, *this->strides_, 0);
+  }
+
+  // compares by count only, so it doesn't walk (or allocate) anything
+  iterator end() const {
+    static const std::vector<int> none;
+    return iterator(this->base_, none, none, this->size_);
+  }
+
+  size_t size() const {
+    return this->size_;
+  }
+};
@@ -0,0 +1,256 @@
+#include "tape.h"
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "tensor.h"
+#include "value.h"
+
+Tape& Tape::current() {
+  // never destroyed, so Values outliving their thread can still release
+  static thread_local Tape* tape = new Tape();
+  return *tape;
+}
+
+void Tape::record(Value* out) {
+  out->_tape = this;
+  out->_tape_idx = int(this->nodes_.size());
+  this->nodes_.push_back(out);
+}
+
+void Tape::release(int idx) {
+  this->nodes_[idx] = nullptr;
+  this->dead_++;
+  if (this->walking_) {
+    // the walk indexes `nodes_`, it's trimmed once the walk is done
+    return;
+  }
+  this->trim();
+  if (this->dead_ > 1024 && this->dead_ > this->nodes_.size() / 2) {
+    this->compact();
+  }
+}
+
+void Tape::trim() {
+  // nodes die roughly in reverse order, so most of them just pop
+  while (!this->nodes_.empty() && this->nodes_.back() == nullptr) {
+    this->nodes_.pop_back();
+    this->dead_--;
+  }
+}
+
+void Tape::compact() {
+  size_t j = 0;
+  for (size_t i = 0; i < this->nodes_.size(); i++) {
+    if (this->nodes_[i] == nullptr) {
+      continue;
+    }
+    this->nodes_[j] = this->nodes_[i];
+    this->nodes_[j]->_tape_idx = int(j);
+    j++;
+  }
+  this->nodes_.resize(j);
+  this->dead_ = 0;
+}
+
+void Tape::accumulate(Value* v, double g) {
+  if (!v->requires_grad) {
+    return;
+  }
+  v->grad += g;
+  if (this->tensor_seeds_ != nullptr && v->_extra != nullptr &&
+      v->_extra->tensor != nullptr) {
+    this->tensor_seeds_->push_back(
+        {v->_extra->tensor, v->_extra->tensor_idx, g});
+  }
+}
+
+void Tape::backward_step(Value* out) {
+  Value* x = out->_in[0].get();
+  Value* rhs = out->_in[1].get();
+  double saved = out->saved;
+  double g = out->grad;
+
+  switch (out->op) {
+    case Op::Leaf:
+      break;
+    case Op::Add:
+      this->accumulate(x, g);
+      this->accumulate(rhs, g);
+      break;
+    case Op::AddScalar:
+    case Op::SubScalar:
+      this->accumulate(x, g);
+      break;
+    case Op::Sub:
+      this->accumulate(x, g);
+      this->accumulate(rhs, -g);
+      break;
+    case Op::Mul:
+      this->accumulate(x, rhs->data * g);
+      this->accumulate(rhs, x->data * g);
+      break;
+    case Op::MulScalar:
+      this->accumulate(x, saved * g);
+      break;
+    case Op::Div:
+      // gradient of (x / other) is (1 / other), and w.r.t. other is
+      // (-x / other^2)
+      this->accumulate(x, (1.0 / rhs->data) * g);
+      this->accumulate(
+          rhs, (-x->data / (rhs->data * rhs->data)) * g);
+      break;
+    case Op::DivScalar:
+      this->accumulate(x, (1.0 / saved) * g);
+      break;
+    case Op::RDiv:
+      // gradient of (other / x) is (- other/x^2)
+      this->accumulate(x, (-saved / (x->data * x->data)) * g);
+      break;
+    case Op::Pow:
+      // n * (x^(n-1))
+      this->accumulate(x, (saved * std::pow(x->data, saved - 1)) * g);
+      break;
+    case Op::Neg:
+      this->accumulate(x, -g);
+      break;
+    case Op::Exp:
+      this->accumulate(x, out->data * g); // e^x => e^x
+      break;
+    case Op::Ln:
+      this->accumulate(x, (1 / x->data) * g); // ln(x) => 1/x
+      break;
+    case Op::Relu:
+      this->accumulate(x, g * (out->data > 0 ? 1.0 : 0.0));
+      break;
+    case Op::Tanh:
+      // gradient of tanh(x) is (1 - tanh^2(x))
+      this->accumulate(x, (1.0 - (out->data * out->data)) * g);
+      break;
+    case Op::Sigmoid:
+      // differentiation of sigmoid(x) => sigmoid(x) * (1-sigmoid(x))
+      this->accumulate(x, out->data * (1.0 - out->data) * g);
+      break;
+    case Op::LeakyRelu:
+      this->accumulate(x, (x->data > 0 ? 1.0 : saved) * g);
+      break;
+    case Op::Gelu: {
+      double sqrt2OverPi = std::sqrt(2.0 / M_PI);
+      double tanhVal = saved; // from forward
+      double factor = 0.5 * (1.0 + tanhVal) +
+          0.5 * x->data * (1.0 - tanhVal * tanhVal) * sqrt2OverPi *
+              (1.0 + 3 * 0.044715 * x->data * x->data);
+      this->accumulate(x, factor * g);
+      break;
+    }
+    case Op::Sum:
+      for (size_t i = 0; i < out->num_inputs(); i++) {
+        this->accumulate(out->input(i), g);
+      }
+      break;
+    case Op::Dot: {
+      size_t n = out->num_inputs() / 2;
+      for (size_t i = 0; i < n; i++) {
+        Value* a = out->input(i);
+        Value* b = out->input(n + i);
+        this->accumulate(a, b->data * g);
+        this->accumulate(b, a->data * g);
+      }
+      break;
+    }
+  }
+}
+
+// send the gradients that reached tensor elements into the tensor graph
+static void backward_into_tensors(
+    const std::vector<TensorSeed>& seeds,
+    bool retain_graph) {
+  std::vector<std::shared_ptr<Tensor>> roots;
+  std::vector<std::vector<double>> root_grads;
+  for (auto& seed : seeds) {
+    size_t r = 0;
+    while (r < roots.size() && roots[r] != seed.tensor) {
+      r++;
+    }
+    if (r == roots.size()) {
+      roots.push_back(seed.tensor);
+      root_grads.emplace_back(seed.tensor->data.size(), 0.0);
+    }
+    root_grads[r][seed.idx] += seed.grad;
+  }
+  Tensor::backward(roots, root_grads, retain_graph);
+}
+
+void Tape::backward(Value* root, bool retain_graph) {
+  // go one variable at a time and apply the chain rule to get its gradient
+  root->grad = 1.0;
+
+  std::vector<TensorSeed> seeds;
+  if (root->tensor() != nullptr) {
+    seeds.push_back({root->tensor(), root->tensor_idx(), 1.0});
+  }
+
+  if (root->_tape_idx >= 0) {
+    this->tensor_seeds_ = &seeds;
+    this->walking_ = true;
+
+    // a node is reached if it's the root or an input of a reached node.
+    // Nodes are in topological order, so a reversed walk visits every
+    // consumer before the node it consumes.
+    //
+    // Once a node's step has run, its gradient has reached its inputs and
+    // it's consumed: its slot is released and its inputs dropped. Reached
+    // inputs are held in `holds` until their own step, so only the frontier
+    // of the walk is alive and memory falls as backward goes on.
+    std::vector<std::shared_ptr<Value>> holds(root->_tape_idx + 1);
+    int pending = 1;
+    root->_reached = true;
+    for (int i = root->_tape_idx; i >= 0 && pending > 0; i--) {
+      Value* v = this->nodes_[i];
+      if (v == nullptr || !v->_reached) {
+        continue;
+      }
+      v->_reached = false;
+      pending--;
+      this->backward_step(v);
+
+      std::shared_ptr<Value> self = std::move(holds[i]);
+      std::shared_ptr<Value> in[2] = {
+          std::move(v->_in[0]), std::move(v->_in[1])};
+      std::vector<std::shared_ptr<Value>> nary;
+      if (v->_extra != nullptr) {
+        nary = std::move(v->_extra->inputs);
+        v->_extra->inputs.clear();
+      }
+      v->clearBackwardMethod(); // slot `i` is released here
+
+      auto reach = [this, &holds, &pending](std::shared_ptr<Value>& input) {
+        if (input == nullptr || input->_tape != this) {
+          return; // a leaf, nothing left to do for it
+        }
+        if (!input->_reached) {
+          input->_reached = true;
+          holds[input->_tape_idx] = std::move(input);
+          pending++;
+        }
+      };
+      reach(in[0]);
+      reach(in[1]);
+      for (auto& input : nary) {
+        reach(input);
+      }
+      // may free `v` and the leaves only it kept alive
+      in[0].reset();
+      in[1].reset();
+      nary.clear();
+      self.reset();
+    }
+
+    this->tensor_seeds_ = nullptr;
+    this->walking_ = false;
+    this->trim();
+  }
+
+  if (!seeds.empty()) {
+    backward_into_tensors(seeds, retain_graph);
+  }
+}
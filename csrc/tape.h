@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Tensor;
+class Value;
+
+// the scalar op that produced a Value
+enum class Op : uint8_t {
+  Leaf, // not produced by an op
+  Add,
+  AddScalar,
+  Sub,
+  SubScalar,
+  Mul,
+  MulScalar,
+  Div,
+  DivScalar,
+  RDiv,
+  Pow,
+  Neg,
+  Exp,
+  Ln,
+  Relu,
+  Tanh,
+  Gelu,
+  Sigmoid,
+  LeakyRelu,
+  Sum, // n-ary
+  Dot, // n-ary, the inputs are [a..., b...]
+};
+
+// gradient that reached an element of a tensor (through `Tensor::get`)
+struct TensorSeed {
+  std::shared_ptr<Tensor> tensor;
+  int idx;
+  double grad;
+};
+
+/// Tape (Wengert list)
+/// Every scalar op appends its output node to the tape of the current
+/// thread, so the nodes are already in topological order. Backward walks the
+/// tape in reverse from the root and applies the chain rule of each reached
+/// node, with no hashing or recursion.
+///
+/// A node carries its own op, inputs and saved operand, so the tape is just
+/// a list of raw pointers: a Value keeps its inputs alive, and releases its
+/// own slot when it's destroyed.
+class Tape {
+private:
+  std::vector<Value*> nodes_;
+  size_t dead_ = 0; // released slots still in `nodes_`
+  // no trimming or compaction while a backward pass walks the tape
+  bool walking_ = false;
+
+  // gradients sent to Values taken from a tensor, during a backward pass
+  std::vector<TensorSeed>* tensor_seeds_ = nullptr;
+
+  void accumulate(Value* v, double g);
+  void trim(); // pops the released slots at the end
+  void compact();
+
+public:
+  static Tape& current();
+
+  void record(Value* out);
+  void release(int idx);
+
+  // apply the chain rule of the op that produced `out`: grad of `out` into
+  // its inputs
+  void backward_step(Value* out);
+
+  // backprop from `root`. Each visited node is consumed (slot released,
+  // inputs dropped) right after its own step, so intermediate nodes are
+  // freed during the walk, not after it. The tensor graph behind the
+  // reached tensor elements is consumed too, unless `retain_graph`.
+  void backward(Value* root, bool retain_graph = false);
+
+  size_t size() {
+    return this->nodes_.size() - this->dead_;
+  }
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/// Teardown
+/// Drops references to graph nodes without recursing. A node's destructor
+/// hands its inputs to `release` instead of letting them go; the outermost
+/// call frees the queued nodes one at a time, so destroying a chain of a
+/// million nodes takes a loop, not a million nested destructors.
+template <class T>
+class Teardown {
+private:
+  struct State {
+    std::vector<std::shared_ptr<T>> queue;
+    bool draining = false;
+  };
+
+  static State& state() {
+    // never destroyed, so nodes outliving their thread can still be freed.
+    // Listed in `all`, like the arenas, so the state of a thread that exited
+    // isn't lost along with it.
+    static thread_local State* state = [] {
+      static std::mutex mutex;
+      static std::vector<State*>* all = new std::vector<State*>();
+      State* s = new State();
+      std::lock_guard<std::mutex> lock(mutex);
+      all->push_back(s);
+      return s;
+    }();
+    return *state;
+  }
+
+public:
+  static void release(std::shared_ptr<T>&& node) {
+    if (node == nullptr) {
+      return;
+    }
+    if (node.use_count() > 1) {
+      node.reset(); // not the last reference, nothing gets destroyed
+      return;
+    }
+
+    State& s = state();
+    s.queue.push_back(std::move(node));
+    if (s.draining) {
+      return; // an outer call frees it
+    }
+    s.draining = true;
+    while (!s.queue.empty()) {
+      std::shared_ptr<T> next = std::move(s.queue.back());
+      s.queue.pop_back();
+      next.reset(); // may queue the inputs of `next`
+    }
+    s.draining = false;
+  }
+};
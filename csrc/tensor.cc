@@ -1,7 +1,33 @@
 #include "tensor.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
+#include "arena.h"
+#include "fusion.h"
+#include "gemm.h"
+#include "reduce.h"
+#include "thread_pool.h"
+#include "vmath.h"
+
+// elements a thread takes in the elementwise loops
+static constexpr size_t kElementwiseGrain = 1 << 14;
+
+// fn(lo, hi) over chunks of [0, n), split between the intra-op threads
+template <class Fn>
+static void for_each_chunk(size_t n, Fn&& fn) {
+  parallel_for(0, n, kElementwiseGrain, fn);
+}
 
 // ==== my lightning ai interview question (with Luca Antiga, CTO, Lightning AI)
 // that I miserably failed. :(
@@ -16,21 +42,9 @@
 ///                                  (3,3,2) => [0,2,0] = 4
 ///                                  (3,3,2) => [0,2,1] = 5
 ///                                  (3,3,2) => [1,0,0] = 6
-int Tensor::normalize_idx(std::vector<int> idx) {
+int Tensor::normalize_idx(const std::vector<int>& idx) {
   if (idx.size() != this->shape.size()) {
-    std::string shape_str = "";
-    for (auto& e : this->shape) {
-      shape_str += std::to_string(e) + ",";
-    }
-
-    std::string idx_str = "";
-    for (auto& e : idx) {
-      idx_str += std::to_string(e) + ",";
-    }
-    std::string error_string =
-        "idx and tensor's shape don't have similar dims: tensor shape (" +
-        shape_str + ") vs idx shape(" + idx_str + ")\n";
-    throw std::runtime_error(error_string);
+    this->throw_bad_index(idx.data(), idx.size());
   }
 
   int final_idx = 0;
@@ -42,9 +56,1533 @@ int Tensor::normalize_idx(std::vector<int> idx) {
     // }
     // _curr_pro *= idx[i];
 
-    // simply use strides instead of recomputing each time
-    int _curr_pro = idx[i] * this->strides[i];
-    final_idx += _curr_pro;
+    // row-major over the shape (not `strides`, which a view may permute)
+    final_idx = final_idx * this->shape[i] + idx[i];
   }
   return final_idx;
 }
+
+// wrong number of dims, or (for `at`) an index out of range. The message is
+// only built here, off the path of the accesses that pass.
+void Tensor::throw_bad_index(const int* idx, size_t n) const {
+  std::string shape_str = "";
+  for (auto& e : this->shape) {
+    shape_str += std::to_string(e) + ",";
+  }
+
+  std::string idx_str = "";
+  for (size_t i = 0; i < n; i++) {
+    idx_str += std::to_string(idx[i]) + ",";
+  }
+  std::string error_string = n != this->shape.size()
+      ? "idx and tensor's shape don't have similar dims: tensor shape ("
+      : "idx out of range of tensor's shape: tensor shape (";
+  error_string += shape_str + ") vs idx (" + idx_str + ")\n";
+  throw std::runtime_error(error_string);
+}
+
+// ========== autograd ==========
+
+/// BuildTopo
+/// iterative post-order DFS from the roots. Each backward pass gets a new
+/// epoch, and a tensor stamped with the current epoch is already visited, so
+/// there is no hash set and no recursion (long chains can't overflow the
+/// stack). Tensors that don't require grad are left out, they never get a
+/// gradient. Raw pointers are fine, the roots keep the whole graph alive.
+void Tensor::build_topo(
+    const std::vector<std::shared_ptr<Tensor>>& roots,
+    std::vector<Tensor*>& topo_list) {
+  static std::atomic<uint64_t> epoch_counter{0};
+  uint64_t epoch = ++epoch_counter;
+
+  // (tensor, index of the next child to visit)
+  std::vector<std::pair<Tensor*, size_t>> stack;
+  for (auto& root : roots) {
+    if (root == nullptr || root->_epoch == epoch) {
+      continue;
+    }
+    root->_epoch = epoch;
+    stack.emplace_back(root.get(), 0);
+
+    while (!stack.empty()) {
+      auto& [t, next_child] = stack.back();
+      if (next_child < t->_prev.size()) {
+        Tensor* child = t->_prev[next_child++].get();
+        if (child->requires_grad && child->_epoch != epoch) {
+          child->_epoch = epoch;
+          stack.emplace_back(child, 0);
+        }
+        continue;
+      }
+      topo_list.push_back(t);
+      stack.pop_back();
+    }
+  }
+}
+
+namespace {
+
+constexpr size_t kGradStripes = 64;
+
+size_t grad_stripe_of(const void* p) {
+  return (reinterpret_cast<uintptr_t>(p) >> 6) % kGradStripes;
+}
+
+// recursive: a closure may lock its inputs again under the lock the
+// backward pass holds for it
+std::recursive_mutex& grad_stripe(size_t i) {
+  static std::recursive_mutex locks[kGradStripes];
+  return locks[i];
+}
+
+} // namespace
+
+GradLock::GradLock(const std::vector<std::shared_ptr<Tensor>>& inputs) {
+  for (auto& input : inputs) {
+    if (input->requires_grad) {
+      this->stripes_.push_back(grad_stripe_of(input.get()));
+    }
+  }
+  this->lock_all();
+}
+
+GradLock::GradLock(std::initializer_list<const Tensor*> inputs) {
+  for (const Tensor* input : inputs) {
+    if (input->requires_grad) {
+      this->stripes_.push_back(grad_stripe_of(input));
+    }
+  }
+  this->lock_all();
+}
+
+void GradLock::lock_all() {
+  std::sort(this->stripes_.begin(), this->stripes_.end());
+  this->stripes_.erase(
+      std::unique(this->stripes_.begin(), this->stripes_.end()),
+      this->stripes_.end());
+  for (size_t i : this->stripes_) {
+    grad_stripe(i).lock();
+  }
+}
+
+GradLock::~GradLock() {
+  for (auto it = this->stripes_.rbegin(); it != this->stripes_.rend(); ++it) {
+    grad_stripe(*it).unlock();
+  }
+}
+
+std::mutex& GradLock::value_stripe(const Value* v) {
+  static std::mutex locks[kGradStripes];
+  return locks[grad_stripe_of(v)];
+}
+
+/// BackwardParallel
+/// A tensor's gradient is complete once every tensor consuming it has run
+/// its closure. So each tensor counts its pending consumers, and the one
+/// that finishes last schedules it on the thread pool: independent branches
+/// of the graph run at the same time, and a tensor never runs before its
+/// consumers.
+///
+/// A chain (or a single pass of a sequential model) has nothing to run side
+/// by side, it's left to the serial loop. So is a pass started on a worker
+/// (like the one of a checkpointed segment), it would block the pool.
+bool Tensor::backward_parallel(
+    const std::vector<std::shared_ptr<Tensor>>& roots,
+    const std::vector<Tensor*>& topo_list,
+    bool retain_graph) {
+  if (ThreadPool::on_worker() || ThreadPool::global().size() < 2) {
+    return false;
+  }
+  ThreadPool& pool = ThreadPool::global();
+
+  size_t n = topo_list.size();
+  for (size_t i = 0; i < n; i++) {
+    topo_list[i]->_topo_pos = i;
+  }
+
+  // inputs with a closure of each tensor, and the consumers of each tensor
+  // that haven't run yet. Leaves have nothing to run, they're left out.
+  std::vector<std::vector<size_t>> inputs(n);
+  std::unique_ptr<std::atomic<int>[]> pending(new std::atomic<int>[n]);
+  for (size_t i = 0; i < n; i++) {
+    pending[i] = 0;
+  }
+  size_t remaining = 0;
+  bool branching = false;
+  for (size_t i = 0; i < n; i++) {
+    Tensor* t = topo_list[i];
+    if (t->is_leaf()) {
+      continue;
+    }
+    remaining++;
+    for (auto& input : t->_prev) {
+      if (input->requires_grad && !input->is_leaf()) {
+        inputs[i].push_back(input->_topo_pos);
+        pending[input->_topo_pos]++;
+      }
+    }
+    branching = branching || inputs[i].size() > 1;
+  }
+
+  std::vector<size_t> ready;
+  for (size_t i = 0; i < n; i++) {
+    if (!topo_list[i]->is_leaf() && pending[i] == 0) {
+      ready.push_back(i);
+    }
+  }
+  if (!branching && ready.size() < 2) {
+    return false;
+  }
+
+  std::vector<bool> is_root(n, false);
+  for (auto& root : roots) {
+    if (root != nullptr) {
+      is_root[root->_topo_pos] = true;
+    }
+  }
+  // without `retain_graph`: keeps a tensor alive from the time its last
+  // consumer lets go of it until its own closure has run
+  std::vector<std::shared_ptr<Tensor>> holds(n);
+
+  std::mutex done_mutex; // guards `remaining` and `error`
+  std::condition_variable done_cv;
+  std::exception_ptr error = nullptr;
+
+  std::function<void(size_t)> run = [&](size_t i) {
+    Tensor* t = topo_list[i];
+    try {
+      GradLock lock(t->_prev);
+      t->executeBackWardMethod();
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(done_mutex);
+      if (error == nullptr) {
+        error = std::current_exception();
+      }
+    }
+
+    for (size_t j : inputs[i]) {
+      if (pending[j].fetch_sub(1) == 1) {
+        if (!retain_graph) {
+          holds[j] = topo_list[j]->shared_from_this();
+        }
+        pool.submit([&run, j]() { run(j); });
+      }
+    }
+    if (!retain_graph) {
+      t->_prev.clear();
+      t->clearBackwardMethod();
+      if (!is_root[i]) {
+        t->grad.clear();
+      }
+      holds[i].reset(); // may free `t`
+    }
+
+    // notify under the lock: the waiting thread may return (and destroy the
+    // condition variable) as soon as it's released
+    std::lock_guard<std::mutex> guard(done_mutex);
+    if (--remaining == 0) {
+      done_cv.notify_all();
+    }
+  };
+
+  for (size_t i : ready) {
+    pool.submit([&run, i]() { run(i); });
+  }
+  std::unique_lock<std::mutex> lock(done_mutex);
+  done_cv.wait(lock, [&remaining]() { return remaining == 0; });
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+  return true;
+}
+
+void Tensor::backward(
+    const std::vector<std::shared_ptr<Tensor>>& roots,
+    const std::vector<std::vector<double>>& root_grads,
+    bool retain_graph) {
+  if (roots.size() != root_grads.size()) {
+    throw std::runtime_error(
+        "Tensor backward: every root needs a seed gradient. Got " +
+        std::to_string(roots.size()) + " roots and " +
+        std::to_string(root_grads.size()) + " gradients.");
+  }
+
+  std::vector<Tensor*> topo_list = {};
+  build_topo(roots, topo_list);
+
+  // leaves accumulate, intermediate tensors only hold this pass's gradient
+  for (auto& t : topo_list) {
+    if (t->is_leaf()) {
+      t->grad.resize(t->numel(), 0.0);
+    } else {
+      t->grad.assign(t->numel(), 0.0);
+    }
+  }
+
+  for (size_t r = 0; r < roots.size(); r++) {
+    Storage& g = roots[r]->grad;
+    if (root_grads[r].size() != g.size()) {
+      throw std::runtime_error(
+          "Tensor backward: seed gradient must have " +
+          std::to_string(g.size()) + " elements. Got " +
+          std::to_string(root_grads[r].size()) + ".");
+    }
+    for (size_t i = 0; i < g.size(); i++) {
+      g[i] += root_grads[r][i];
+    }
+  }
+
+  if (backward_parallel(roots, topo_list, retain_graph)) {
+    return;
+  }
+
+  if (retain_graph) {
+    for (int i = int(topo_list.size()) - 1; i >= 0; i--) {
+      topo_list[i]->executeBackWardMethod();
+    }
+    return;
+  }
+
+  // consume the graph: every consumer runs before the tensors it reads, so
+  // after its step a tensor hands its inputs a hold on themselves (they stay
+  // alive until their own step) and lets go of everything else
+  for (int i = int(topo_list.size()) - 1; i >= 0; i--) {
+    Tensor* t = topo_list[i];
+    std::shared_ptr<Tensor> self = std::move(t->_hold);
+    if (t->is_leaf()) {
+      continue; // leaves keep their grad
+    }
+    t->executeBackWardMethod();
+
+    for (auto& input : t->_prev) {
+      if (input->requires_grad && input->_hold == nullptr) {
+        input->_hold = input;
+      }
+    }
+    t->_prev.clear();
+    t->clearBackwardMethod();
+    bool is_root = std::any_of(roots.begin(), roots.end(), [t](auto& root) {
+      return root.get() == t;
+    });
+    if (!is_root) {
+      t->grad.clear();
+    }
+    self.reset(); // may free `t`
+  }
+}
+
+void Tensor::backward(bool retain_graph) {
+  std::vector<double> ones(this->numel(), 1.0);
+  Tensor::backward({shared_from_this()}, {ones}, retain_graph);
+}
+
+// ========== strided iteration ==========
+
+// calls `f(i, pos)` for the i-th element (row-major) of a tensor laid out by
+// `shape` & `strides`, `pos` being its position in the storage
+template <class F>
+static void for_each_position(
+    const std::vector<int>& shape,
+    const std::vector<int>& strides,
+    F f) {
+  size_t n = 1;
+  for (int e : shape) {
+    n *= e;
+  }
+  StridedCursor cursor(shape, strides);
+  for (size_t i = 0; i < n; i++, cursor.next()) {
+    f(i, cursor.pos());
+  }
+}
+
+static std::vector<int> row_major_strides(const std::vector<int>& shape) {
+  std::vector<int> strides(shape.size(), 1);
+  for (int d = int(shape.size()) - 2; d >= 0; d--) {
+    strides[d] = strides[d + 1] * shape[d + 1];
+  }
+  return strides;
+}
+
+// calls `f(i, pa, pb)` for the i-th element (row-major) of a tensor of
+// `shape`, `pa` and `pb` being the positions of its operands, laid out by
+// `sa` and `sb`
+template <class F>
+static void for_each_position(
+    const std::vector<int>& shape,
+    const std::vector<int>& sa,
+    const std::vector<int>& sb,
+    F f) {
+  size_t n = 1;
+  for (int e : shape) {
+    n *= e;
+  }
+  std::vector<int> idx(shape.size(), 0);
+  int pa = 0;
+  int pb = 0;
+  for (size_t i = 0; i < n; i++) {
+    f(i, pa, pb);
+    for (int d = int(shape.size()) - 1; d >= 0; d--) {
+      pa += sa[d];
+      pb += sb[d];
+      if (++idx[d] < shape[d]) {
+        break;
+      }
+      pa -= sa[d] * shape[d];
+      pb -= sb[d] * shape[d];
+      idx[d] = 0;
+    }
+  }
+}
+
+// ========== tensor-ops ==========
+// Each op computes its output over the contiguous buffers in one loop, and
+// registers a single backward closure for the whole tensor. The forward loop
+// is a closure too, kept on the output so a captured graph can rerun it.
+// Closures capture raw pointers: inputs are kept alive by `_prev` of the
+// output, and the output only runs its closures while alive.
+
+/// BroadcastOp
+/// out = f(a, b) elementwise, with numpy broadcasting: the shapes are
+/// aligned on their last dim, and a dim that's missing or of size 1 is
+/// stretched to the other's size. A stretched operand is read with a stride
+/// of 0 along that dim, so it's never expanded in memory; in backward its
+/// elements accumulate the grads of every output they were read for, which
+/// sums the gradient over the broadcast dims.
+///
+/// `da(x, y, z)` and `db(x, y, z)` are d(out)/d(a) and d(out)/d(b) for
+/// `a = x`, `b = y` and `out = z`.
+template <class F, class DA, class DB>
+std::shared_ptr<Tensor> Tensor::broadcast_op(
+    std::shared_ptr<Tensor> other,
+    char op,
+    F f,
+    DA da,
+    DB db) {
+  if (!other) {
+    throw std::runtime_error(
+        std::string("Cannot apply tensor-op '") + op + "' to a null tensor.");
+  }
+  if (!this->is_contiguous()) {
+    return this->contiguous()->broadcast_op(other, op, f, da, db);
+  }
+  other = other->contiguous();
+
+  const std::vector<int>& a_shape = this->shape;
+  const std::vector<int>& b_shape = other->shape;
+  size_t dims = std::max(a_shape.size(), b_shape.size());
+  std::vector<int> out_shape(dims);
+  std::vector<int> sa(dims, 0);
+  std::vector<int> sb(dims, 0);
+  for (size_t d = 0; d < dims; d++) {
+    // dim `d` of the output, counted from the last one
+    size_t r = dims - 1 - d;
+    int a_dim = r < a_shape.size() ? a_shape[a_shape.size() - 1 - r] : 1;
+    int b_dim = r < b_shape.size() ? b_shape[b_shape.size() - 1 - r] : 1;
+    if (a_dim != b_dim && a_dim != 1 && b_dim != 1) {
+      throw std::runtime_error(
+          std::string("Tensors can't be broadcast together for tensor-op '") +
+          op + "'. Got shapes: " + this->tensor_shape_str() + " and " +
+          other->tensor_shape_str());
+    }
+    out_shape[d] = std::max(a_dim, b_dim);
+    if (a_dim != 1) {
+      sa[d] = this->strides[this->strides.size() - 1 - r];
+    }
+    if (b_dim != 1) {
+      sb[d] = other->strides[other->strides.size() - 1 - r];
+    }
+  }
+  bool same_shape = a_shape == b_shape;
+
+  std::shared_ptr<Tensor> out = make_node<Tensor>(out_shape, Uninitialized{});
+
+  Tensor* lhs = this;
+  Tensor* rhs = other.get();
+  Tensor* res = out.get();
+  auto forward = [lhs, rhs, res, sa, sb, same_shape, f]() {
+    const double* a = lhs->data.data();
+    const double* b = rhs->data.data();
+    double* o = res->data.data();
+    if (same_shape) {
+      size_t n = res->data.size();
+      for (size_t i = 0; i < n; i++) {
+        o[i] = f(a[i], b[i]);
+      }
+      return;
+    }
+    for_each_position(res->shape, sa, sb, [&](size_t i, int pa, int pb) {
+      o[i] = f(a[pa], b[pb]);
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this, other.get()})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this(), other};
+  out->_op = op;
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([lhs, rhs, res, sa, sb, da, db]() {
+    const double* a = lhs->data.data();
+    const double* b = rhs->data.data();
+    const double* o = res->data.data();
+    const double* g = res->grad.data();
+    bool need_da = lhs->requires_grad;
+    bool need_db = rhs->requires_grad;
+    double* ga = lhs->grad.data();
+    double* gb = rhs->grad.data();
+    for_each_position(res->shape, sa, sb, [&](size_t i, int pa, int pb) {
+      if (need_da) {
+        ga[pa] += da(a[pa], b[pb], o[i]) * g[i];
+      }
+      if (need_db) {
+        gb[pb] += db(a[pa], b[pb], o[i]) * g[i];
+      }
+    });
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::add(std::shared_ptr<Tensor> other) {
+  return broadcast_op(
+      std::move(other),
+      '+',
+      [](double x, double y) { return x + y; },
+      [](double, double, double) { return 1.0; },
+      [](double, double, double) { return 1.0; });
+}
+
+std::shared_ptr<Tensor> Tensor::sub(std::shared_ptr<Tensor> other) {
+  return broadcast_op(
+      std::move(other),
+      '-',
+      [](double x, double y) { return x - y; },
+      [](double, double, double) { return 1.0; },
+      [](double, double, double) { return -1.0; });
+}
+
+std::shared_ptr<Tensor> Tensor::mul(std::shared_ptr<Tensor> other) {
+  return broadcast_op(
+      std::move(other),
+      '*',
+      [](double x, double y) { return x * y; },
+      [](double, double y, double) { return y; },
+      [](double x, double, double) { return x; });
+}
+
+std::shared_ptr<Tensor> Tensor::div(std::shared_ptr<Tensor> other) {
+  // gradient of (x / y) is (1 / y), and w.r.t. y is (-x / y^2)
+  return broadcast_op(
+      std::move(other),
+      '/',
+      [](double x, double y) { return x / y; },
+      [](double, double y, double) { return 1.0 / y; },
+      [](double x, double y, double) { return -x / (y * y); });
+}
+
+std::shared_ptr<Tensor> Tensor::maximum(std::shared_ptr<Tensor> other) {
+  // a tie sends the gradient to `this`
+  return broadcast_op(
+      std::move(other),
+      'x',
+      [](double x, double y) { return x >= y ? x : y; },
+      [](double x, double y, double) { return x >= y ? 1.0 : 0.0; },
+      [](double x, double y, double) { return x >= y ? 0.0 : 1.0; });
+}
+
+// `other` takes part in the tensor graph as a leaf: its gradient is
+// accumulated, but the scalar graph behind it can't be traversed, so a Value
+// with a graph is refused.
+std::shared_ptr<Tensor> Tensor::div(std::shared_ptr<Value> other) {
+  this->check_no_graph(*other, "div");
+  if (!this->is_contiguous()) {
+    return this->contiguous()->div(other);
+  }
+  std::shared_ptr<Tensor> out = make_node<Tensor>(this->shape, Uninitialized{});
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, other, res]() {
+    if (other->data == 0) {
+      throw std::runtime_error("Division is not supported by Value(0)");
+    }
+    double d = other->data;
+    const double* x = self->data.data();
+    double* o = res->data.data();
+    size_t n = res->data.size();
+    for (size_t i = 0; i < n; i++) {
+      o[i] = x[i] / d;
+    }
+  };
+  forward();
+
+  out->requires_grad = other->requires_grad;
+  if (!out->record_grad_from({this})) {
+    out->requires_grad = false;
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = '/';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, other, res]() {
+    // gradient of (x / d) is (1 / d), and w.r.t. d is (-x / d^2)
+    double d = other->data;
+    if (self->requires_grad) {
+      for (size_t i = 0; i < res->grad.size(); i++) {
+        self->grad[i] += res->grad[i] / d;
+      }
+    }
+    if (other->requires_grad) {
+      double other_grad = 0.0;
+      for (size_t i = 0; i < res->grad.size(); i++) {
+        other_grad += (-self->data[i] / (d * d)) * res->grad[i];
+      }
+      std::lock_guard<std::mutex> lock(GradLock::value_stripe(other.get()));
+      other->grad += other_grad;
+    }
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::matmul(std::shared_ptr<Tensor> other) {
+  if (!other) {
+    throw std::runtime_error("Cannot perform matmul with a null tensor.");
+  }
+  if (!this->is_contiguous()) {
+    return this->contiguous()->matmul(other);
+  }
+  other = other->contiguous();
+
+  int a_dims = this->dims();
+  int b_dims = other->dims();
+  if (a_dims > 3 || b_dims > 3) {
+    throw std::runtime_error(
+        "matmul supports tensors of up to 3 dims. Got shapes: " +
+        this->tensor_shape_str() + " and " + other->tensor_shape_str());
+  }
+
+  // (batch, rows, cols) of each side. A vector on the left is a single row,
+  // on the right a single column; a 2-D operand is shared by every batch.
+  int a_batch = a_dims == 3 ? this->shape[0] : 1;
+  int m = a_dims == 1 ? 1 : this->shape[a_dims - 2];
+  int k_dim = this->shape[a_dims - 1];
+  int b_batch = b_dims == 3 ? other->shape[0] : 1;
+  int b_rows = b_dims == 1 ? other->shape[0] : other->shape[b_dims - 2];
+  int n = b_dims == 1 ? 1 : other->shape[b_dims - 1];
+
+  if (k_dim != b_rows ||
+      (a_batch != b_batch && a_batch != 1 && b_batch != 1)) {
+    throw std::runtime_error(
+        "Dimensions do not align for matmul. Got shapes: " +
+        this->tensor_shape_str() + " and " + other->tensor_shape_str());
+  }
+
+  // a vector on the left keeps its row: (k) @ (k, n) is (1, n)
+  int batch = std::max(a_batch, b_batch);
+  std::vector<int> output_shape;
+  if (a_dims == 3 || b_dims == 3) {
+    output_shape.push_back(batch);
+  }
+  output_shape.push_back(m);
+  if (b_dims != 1) {
+    output_shape.push_back(n);
+  }
+  std::shared_ptr<Tensor> out =
+      make_node<Tensor>(output_shape, Uninitialized{});
+
+  // a broadcast operand has a batch stride of 0
+  long stride_a = a_batch == 1 ? 0 : long(m) * k_dim;
+  long stride_b = b_batch == 1 ? 0 : long(k_dim) * n;
+  long stride_c = long(m) * n;
+
+  Tensor* lhs = this;
+  Tensor* rhs = other.get();
+  Tensor* res = out.get();
+  auto forward =
+      [lhs, rhs, res, batch, m, k_dim, n, stride_a, stride_b, stride_c]() {
+        std::fill(res->data.begin(), res->data.end(), 0.0);
+        gemm_batched(
+            batch,
+            false,
+            false,
+            m,
+            n,
+            k_dim,
+            lhs->data.data(),
+            k_dim,
+            stride_a,
+            rhs->data.data(),
+            n,
+            stride_b,
+            res->data.data(),
+            n,
+            stride_c);
+      };
+  forward();
+
+  if (!out->record_grad_from({this, other.get()})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this(), other};
+  out->_op = '@';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod(
+      [lhs, rhs, res, batch, m, k_dim, n, stride_a, stride_b, stride_c]() {
+        const double* a = lhs->data.data();
+        const double* b = rhs->data.data();
+        const double* dc = res->grad.data();
+        // dA = dC . B^T  and  dB = A^T . dC, each only if it's needed. A
+        // broadcast operand (stride 0) sums its grad over the batch.
+        if (lhs->requires_grad) {
+          double* da = lhs->grad.data();
+          gemm_batched(
+              batch,
+              false,
+              true,
+              m,
+              k_dim,
+              n,
+              dc,
+              n,
+              stride_c,
+              b,
+              n,
+              stride_b,
+              da,
+              k_dim,
+              stride_a);
+        }
+        if (rhs->requires_grad) {
+          double* db = rhs->grad.data();
+          gemm_batched(
+              batch,
+              true,
+              false,
+              k_dim,
+              n,
+              m,
+              a,
+              k_dim,
+              stride_a,
+              dc,
+              n,
+              stride_c,
+              db,
+              n,
+              stride_b);
+        }
+      });
+
+  return out;
+}
+
+std::shared_ptr<LazyTensor> Tensor::lazy() {
+  return std::make_shared<LazyTensor>(shared_from_this());
+}
+
+std::shared_ptr<Tensor> Tensor::relu() {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->relu();
+  }
+  std::shared_ptr<Tensor> out = make_node<Tensor>(this->shape, Uninitialized{});
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res]() {
+    for_each_chunk(self->numel(), [&](size_t lo, size_t hi) {
+      for (size_t i = lo; i < hi; i++) {
+        res->data[i] = self->data[i] < 0 ? 0 : self->data[i];
+      }
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = 'r';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res]() {
+    for_each_chunk(res->grad.size(), [&](size_t lo, size_t hi) {
+      for (size_t i = lo; i < hi; i++) {
+        self->grad[i] += res->grad[i] * (res->data[i] > 0 ? 1.0 : 0.0);
+      }
+    });
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::tanh() {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->tanh();
+  }
+  std::shared_ptr<Tensor> out = make_node<Tensor>(this->shape, Uninitialized{});
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res]() {
+    for_each_chunk(self->numel(), [&](size_t lo, size_t hi) {
+      vtanh(self->data.data() + lo, res->data.data() + lo, hi - lo);
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = 't';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res]() {
+    // gradient of tanh(x) is (1 - tanh^2(x))
+    for_each_chunk(res->grad.size(), [&](size_t lo, size_t hi) {
+      tanh_backward(
+          res->data.data() + lo,
+          res->grad.data() + lo,
+          self->grad.data() + lo,
+          hi - lo);
+    });
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::gelu() {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->gelu();
+  }
+  std::shared_ptr<Tensor> out = make_node<Tensor>(this->shape, Uninitialized{});
+
+  // tanh of the GELU approximation's argument, kept from forward for
+  // backward
+  auto tanhVal = std::make_shared<std::vector<double>>(this->numel());
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res, tanhVal]() {
+    for_each_chunk(self->numel(), [&](size_t lo, size_t hi) {
+      vgelu(
+          self->data.data() + lo,
+          res->data.data() + lo,
+          tanhVal->data() + lo,
+          hi - lo);
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = 'g';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res, tanhVal]() {
+    for_each_chunk(res->grad.size(), [&](size_t lo, size_t hi) {
+      gelu_backward(
+          self->data.data() + lo,
+          tanhVal->data() + lo,
+          res->grad.data() + lo,
+          self->grad.data() + lo,
+          hi - lo);
+    });
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::sigmoid() {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->sigmoid();
+  }
+  std::shared_ptr<Tensor> out = make_node<Tensor>(this->shape, Uninitialized{});
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res]() {
+    for_each_chunk(self->numel(), [&](size_t lo, size_t hi) {
+      vsigmoid(self->data.data() + lo, res->data.data() + lo, hi - lo);
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = 's';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res]() {
+    // differentiation of sigmoid(x) => sigmoid(x) * (1-sigmoid(x))
+    for_each_chunk(res->grad.size(), [&](size_t lo, size_t hi) {
+      sigmoid_backward(
+          res->data.data() + lo,
+          res->grad.data() + lo,
+          self->grad.data() + lo,
+          hi - lo);
+    });
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::leakyRelu(double alpha) {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->leakyRelu(alpha);
+  }
+  std::shared_ptr<Tensor> out = make_node<Tensor>(this->shape, Uninitialized{});
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res, alpha]() {
+    for_each_chunk(self->numel(), [&](size_t lo, size_t hi) {
+      for (size_t i = lo; i < hi; i++) {
+        double x = self->data[i];
+        res->data[i] = x > 0 ? x : alpha * x;
+      }
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = 'l';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res, alpha]() {
+    for_each_chunk(res->grad.size(), [&](size_t lo, size_t hi) {
+      for (size_t i = lo; i < hi; i++) {
+        double gradFactor = self->data[i] > 0 ? 1.0 : alpha;
+        self->grad[i] += gradFactor * res->grad[i];
+      }
+    });
+  });
+
+  return out;
+}
+
+// ========== reductions ==========
+
+/// ReducePlan
+/// Where the elements of a reduction are, in a contiguous tensor: output o
+/// reduces the `inner` elements at base[o] + offset[j], j in [0, inner).
+/// The reduced dims may be anywhere, so both are strided walks: `base` over
+/// the kept dims, `offset` over the reduced ones.
+struct ReducePlan {
+  std::vector<int> out_shape;
+  size_t outer = 1;
+  size_t inner = 1;
+  std::vector<int> base;
+  std::vector<int> offset;
+};
+
+static std::shared_ptr<const ReducePlan> reduce_plan(
+    const Tensor& t,
+    std::vector<int> dims,
+    bool keepdim,
+    const std::string& name) {
+  size_t n = t.shape.size();
+  if (dims.empty()) {
+    for (size_t d = 0; d < n; d++) {
+      dims.push_back(int(d));
+    }
+  }
+  std::vector<bool> reduced(n, false);
+  for (int d : dims) {
+    if (d < 0 || d >= int(n) || reduced[d]) {
+      throw std::invalid_argument(
+          name + ": dims must be distinct and in [0, " + std::to_string(n) +
+          "). Got: " + std::to_string(d) +
+          " for shape: " + t.tensor_shape_str());
+    }
+    reduced[d] = true;
+  }
+
+  auto plan = std::make_shared<ReducePlan>();
+  std::vector<int> kept_shape, kept_strides, red_shape, red_strides;
+  for (size_t d = 0; d < n; d++) {
+    if (reduced[d]) {
+      red_shape.push_back(t.shape[d]);
+      red_strides.push_back(t.strides[d]);
+      plan->inner *= t.shape[d];
+      if (keepdim) {
+        plan->out_shape.push_back(1);
+      }
+    } else {
+      kept_shape.push_back(t.shape[d]);
+      kept_strides.push_back(t.strides[d]);
+      plan->outer *= t.shape[d];
+      plan->out_shape.push_back(t.shape[d]);
+    }
+  }
+  if (plan->out_shape.empty()) {
+    plan->out_shape = {1}; // no 0-d tensors
+  }
+
+  plan->base.resize(plan->outer);
+  plan->offset.resize(plan->inner);
+  int* base = plan->base.data();
+  int* offset = plan->offset.data();
+  for_each_position(
+      kept_shape, kept_strides, [&](size_t i, int pos) { base[i] = pos; });
+  for_each_position(
+      red_shape, red_strides, [&](size_t j, int pos) { offset[j] = pos; });
+  return plan;
+}
+
+// fn(o) for every output of `p`: split by output when they are many. The
+// reductions of fn split themselves when `inner` is large.
+template <class Fn>
+static void for_each_output(const ReducePlan& p, Fn fn) {
+  size_t inner = std::max<size_t>(p.inner, 1);
+  size_t grain = std::max<size_t>(1, kReduceBlock / inner);
+  parallel_for(0, p.outer, grain, [&](size_t lo, size_t hi) {
+    for (size_t o = lo; o < hi; o++) {
+      fn(o);
+    }
+  });
+}
+
+// fn(o, pos) for every input element, at `pos` and reduced into output
+// `o`. Each position comes up once, so fn may write to it.
+template <class Fn>
+static void for_each_reduced(const ReducePlan& p, Fn fn) {
+  size_t n = p.outer * p.inner;
+  for_each_chunk(n, [&](size_t lo, size_t hi) {
+    size_t o = lo / p.inner;
+    size_t j = lo % p.inner;
+    for (size_t k = lo; k < hi; k++) {
+      fn(o, p.base[o] + p.offset[j]);
+      if (++j == p.inner) {
+        j = 0;
+        o++;
+      }
+    }
+  });
+}
+
+std::shared_ptr<Tensor> Tensor::sum(std::vector<int> dims, bool keepdim) {
+  return this->reduce_sum(dims, keepdim, 'u');
+}
+
+std::shared_ptr<Tensor> Tensor::mean(std::vector<int> dims, bool keepdim) {
+  return this->reduce_sum(dims, keepdim, 'a');
+}
+
+// sum over `dims`, divided by the elements reduced for the mean ('a')
+std::shared_ptr<Tensor> Tensor::reduce_sum(
+    const std::vector<int>& dims,
+    bool keepdim,
+    char op) {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->reduce_sum(dims, keepdim, op);
+  }
+  std::shared_ptr<const ReducePlan> plan =
+      reduce_plan(*this, dims, keepdim, op == 'a' ? "mean" : "sum");
+  double scale = op == 'a' ? 1.0 / double(plan->inner) : 1.0;
+  std::shared_ptr<Tensor> out =
+      make_node<Tensor>(plan->out_shape, Uninitialized{});
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res, plan, scale]() {
+    const double* x = self->data.data();
+    const int* offset = plan->offset.data();
+    for_each_output(*plan, [&](size_t o) {
+      const double* xo = x + plan->base[o];
+      double s = tree_sum(
+          plan->inner, [xo, offset](size_t j) { return xo[offset[j]]; });
+      res->data[o] = s * scale;
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = op;
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res, plan, scale]() {
+    for_each_reduced(*plan, [&](size_t o, int pos) {
+      self->grad[pos] += res->grad[o] * scale;
+    });
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::max(std::vector<int> dims, bool keepdim) {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->max(dims, keepdim);
+  }
+  std::shared_ptr<const ReducePlan> plan =
+      reduce_plan(*this, dims, keepdim, "max");
+  std::shared_ptr<Tensor> out =
+      make_node<Tensor>(plan->out_shape, Uninitialized{});
+
+  // position of the max of each output, for backward
+  auto argmax = std::make_shared<std::vector<int>>(plan->outer);
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res, plan, argmax]() {
+    const double* x = self->data.data();
+    const int* offset = plan->offset.data();
+    for_each_output(*plan, [&](size_t o) {
+      const double* xo = x + plan->base[o];
+      size_t j = argmax_of(
+          plan->inner, [xo, offset](size_t j) { return xo[offset[j]]; });
+      (*argmax)[o] = plan->base[o] + offset[j];
+      res->data[o] = x[(*argmax)[o]];
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = 'X';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res, argmax]() {
+    for (size_t o = 0; o < argmax->size(); o++) {
+      self->grad[(*argmax)[o]] += res->grad[o];
+    }
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::argmax(std::vector<int> dims, bool keepdim) {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->argmax(dims, keepdim);
+  }
+  std::shared_ptr<const ReducePlan> plan =
+      reduce_plan(*this, dims, keepdim, "argmax");
+  std::shared_ptr<Tensor> out =
+      make_node<Tensor>(plan->out_shape, Uninitialized{});
+
+  const double* x = this->data.data();
+  const int* offset = plan->offset.data();
+  for_each_output(*plan, [&](size_t o) {
+    const double* xo = x + plan->base[o];
+    out->data[o] = double(argmax_of(
+        plan->inner, [xo, offset](size_t j) { return xo[offset[j]]; }));
+  });
+  return out;
+}
+
+std::shared_ptr<Tensor>
+Tensor::var(std::vector<int> dims, bool keepdim, int correction) {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->var(dims, keepdim, correction);
+  }
+  std::shared_ptr<const ReducePlan> plan =
+      reduce_plan(*this, dims, keepdim, "var");
+  double denom = double(plan->inner) - correction;
+  if (denom <= 0) {
+    throw std::invalid_argument(
+        "var: needs more than " + std::to_string(correction) +
+        " elements per reduction. Got: " + std::to_string(plan->inner));
+  }
+  std::shared_ptr<Tensor> out =
+      make_node<Tensor>(plan->out_shape, Uninitialized{});
+
+  // mean of each output, for backward. Two passes (mean, then the squared
+  // deviations from it) don't lose the variance of values far from 0.
+  auto means = std::make_shared<std::vector<double>>(plan->outer);
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res, plan, means, denom]() {
+    const double* x = self->data.data();
+    const int* offset = plan->offset.data();
+    size_t inner = plan->inner;
+    for_each_output(*plan, [&](size_t o) {
+      const double* xo = x + plan->base[o];
+      double m =
+          tree_sum(inner, [xo, offset](size_t j) { return xo[offset[j]]; }) /
+          double(inner);
+      (*means)[o] = m;
+      res->data[o] = tree_sum(inner, [xo, offset, m](size_t j) {
+                       double d = xo[offset[j]] - m;
+                       return d * d;
+                     }) /
+          denom;
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = 'V';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res, plan, means, denom]() {
+    // d/dx_i = 2 (x_i - mean) / denom: the terms through the mean sum to 0
+    for_each_reduced(*plan, [&](size_t o, int pos) {
+      self->grad[pos] +=
+          2.0 * (self->data[pos] - (*means)[o]) / denom * res->grad[o];
+    });
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::softmax() {
+  return this->softmax_over({}, false);
+}
+
+std::shared_ptr<Tensor> Tensor::softmax(int dim) {
+  return this->softmax_over({dim}, false);
+}
+
+std::shared_ptr<Tensor> Tensor::log_softmax(int dim) {
+  return this->softmax_over({dim}, true);
+}
+
+/// SoftmaxOver
+/// softmax (or log-softmax, with `log`) of each row: the elements reduced
+/// together over `dims`. A row goes through max, exp, sum and normalize
+/// while it's in cache, the exps vectorized. Rows along the last dim are
+/// worked on in the output itself, others in a gathered copy.
+///
+/// Backward, in closed form from the output y, with S = sum over the row:
+///   softmax:      dx = y * (dy - S(dy * y))
+///   log-softmax:  dx = dy - exp(y) * S(dy)
+std::shared_ptr<Tensor> Tensor::softmax_over(
+    const std::vector<int>& dims,
+    bool log) {
+  if (!this->is_contiguous()) {
+    return this->contiguous()->softmax_over(dims, log);
+  }
+  std::shared_ptr<const ReducePlan> plan =
+      reduce_plan(*this, dims, false, log ? "log_softmax" : "softmax");
+  std::shared_ptr<Tensor> out = make_node<Tensor>(this->shape, Uninitialized{});
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res, plan, log]() {
+    const int* off = plan->offset.data();
+    size_t m = plan->inner;
+    bool strided = m > 1 && off[1] != 1;
+    for_each_output(*plan, [&](size_t o) {
+      const double* x = self->data.data() + plan->base[o];
+      double* y = res->data.data() + plan->base[o];
+      thread_local std::vector<double> scratch;
+      double* row = y;
+      if (strided) {
+        scratch.resize(m);
+        row = scratch.data();
+      }
+
+      // Step 1: the max, for numerical stability
+      double max_val = x[off[0]];
+      for (size_t j = 0; j < m; j++) {
+        row[j] = x[off[j]];
+        max_val = std::max(max_val, row[j]);
+      }
+      // Step 2: exp(x_j - max_val) and their (pairwise) sum
+      for (size_t j = 0; j < m; j++) {
+        row[j] -= max_val;
+      }
+      vexp(row, row, m);
+      double sum_exp = tree_sum(m, [row](size_t j) { return row[j]; });
+
+      // Step 3: exp(x_j - max_val) / sum_exp, or its log
+      if (log) {
+        double shift = max_val + std::log(sum_exp);
+        for (size_t j = 0; j < m; j++) {
+          y[off[j]] = x[off[j]] - shift;
+        }
+      } else {
+        for (size_t j = 0; j < m; j++) {
+          y[off[j]] = row[j] / sum_exp;
+        }
+      }
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = log ? 'L' : 'S';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res, plan, log]() {
+    const int* off = plan->offset.data();
+    size_t m = plan->inner;
+    for_each_output(*plan, [&](size_t o) {
+      const double* y = res->data.data() + plan->base[o];
+      const double* dy = res->grad.data() + plan->base[o];
+      double* dx = self->grad.data() + plan->base[o];
+      if (!log) {
+        double dot = tree_sum(
+            m, [y, dy, off](size_t j) { return dy[off[j]] * y[off[j]]; });
+        for (size_t j = 0; j < m; j++) {
+          dx[off[j]] += y[off[j]] * (dy[off[j]] - dot);
+        }
+        return;
+      }
+      thread_local std::vector<double> p;
+      p.resize(m);
+      for (size_t j = 0; j < m; j++) {
+        p[j] = y[off[j]];
+      }
+      vexp(p.data(), p.data(), m); // the softmax
+      double sum_dy = tree_sum(m, [dy, off](size_t j) { return dy[off[j]]; });
+      for (size_t j = 0; j < m; j++) {
+        dx[off[j]] += dy[off[j]] - p[j] * sum_dy;
+      }
+    });
+  });
+
+  return out;
+}
+
+// ========== views ==========
+// A view shares the storage of its base and has its own shape, strides and
+// offset, so making one is O(1) and its forward has nothing to compute. The
+// grad of every tensor is row-major though, so the backward of a view maps
+// each of its elements back to the base's.
+
+std::shared_ptr<Tensor> Tensor::make_view(
+    std::vector<int> shape,
+    std::vector<int> strides,
+    int offset) {
+  // elements of the storage the view can reach
+  size_t extent = 1;
+  for (size_t d = 0; d < shape.size(); d++) {
+    if (shape[d] == 0) {
+      extent = 0;
+      break;
+    }
+    extent += size_t(shape[d] - 1) * strides[d];
+  }
+  std::shared_ptr<Tensor> out = make_node<Tensor>(
+      std::move(shape), std::move(strides), this->data.view(offset, extent));
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = 'v';
+
+  Tensor* base = this;
+  Tensor* res = out.get();
+  out->setBackWardMethod([base, res, offset]() {
+    if (base->is_contiguous()) {
+      for_each_position(res->shape, res->strides, [&](size_t i, int pos) {
+        base->grad[offset + pos] += res->grad[i];
+      });
+      return;
+    }
+    // element of the base at each position of its storage
+    std::vector<int> element(base->data.size(), -1);
+    for_each_position(base->shape, base->strides, [&](size_t i, int pos) {
+      element[pos] = int(i);
+    });
+    for_each_position(res->shape, res->strides, [&](size_t i, int pos) {
+      base->grad[element[offset + pos]] += res->grad[i];
+    });
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::contiguous() {
+  if (this->is_contiguous()) {
+    return shared_from_this();
+  }
+  std::shared_ptr<Tensor> out = make_node<Tensor>(this->shape, Uninitialized{});
+
+  Tensor* self = this;
+  Tensor* res = out.get();
+  auto forward = [self, res]() {
+    for_each_position(self->shape, self->strides, [&](size_t i, int pos) {
+      res->data[i] = self->data[pos];
+    });
+  };
+  forward();
+
+  if (!out->record_grad_from({this})) {
+    return out;
+  }
+
+  out->_prev = {shared_from_this()};
+  out->_op = '=';
+
+  out->setForwardMethod(forward);
+  out->setBackWardMethod([self, res]() {
+    // both grads are row-major
+    for (size_t i = 0; i < res->grad.size(); i++) {
+      self->grad[i] += res->grad[i];
+    }
+  });
+
+  return out;
+}
+
+std::shared_ptr<Tensor> Tensor::reshape(std::vector<int> new_shape) {
+  size_t total_ele = 1;
+  for (auto& e : new_shape) {
+    total_ele *= e;
+  }
+  if (total_ele != this->numel()) {
+    throw std::runtime_error(
+        "New shape must be able to contain (" +
+        std::to_string(this->numel()) +
+        "), but new shape can handle: " + std::to_string(total_ele) +
+        " elements.");
+  }
+  if (!this->is_contiguous()) {
+    return this->contiguous()->reshape(std::move(new_shape));
+  }
+  std::vector<int> new_strides = row_major_strides(new_shape);
+  return make_view(std::move(new_shape), std::move(new_strides), 0);
+}
+
+std::shared_ptr<Tensor> Tensor::flatten() {
+  return this->reshape({int(this->numel())});
+}
+
+std::shared_ptr<Tensor> Tensor::transpose(int dim0, int dim1) {
+  int n = int(this->shape.size());
+  if (dim0 < 0 || dim0 >= n || dim1 < 0 || dim1 >= n) {
+    throw std::invalid_argument(
+        "transpose: dims must be in [0, " + std::to_string(n) + "). Got: " +
+        std::to_string(dim0) + " and " + std::to_string(dim1));
+  }
+  std::vector<int> new_shape = this->shape;
+  std::vector<int> new_strides = this->strides;
+  std::swap(new_shape[dim0], new_shape[dim1]);
+  std::swap(new_strides[dim0], new_strides[dim1]);
+  return make_view(std::move(new_shape), std::move(new_strides), 0);
+}
+
+std::shared_ptr<Tensor> Tensor::permute(std::vector<int> dims) {
+  size_t n = this->shape.size();
+  std::vector<bool> seen(n, false);
+  bool valid = dims.size() == n;
+  for (size_t d = 0; valid && d < n; d++) {
+    valid = dims[d] >= 0 && dims[d] < int(n) && !seen[dims[d]];
+    if (valid) {
+      seen[dims[d]] = true;
+    }
+  }
+  if (!valid) {
+    throw std::invalid_argument(
+        "permute expects a permutation of the " + std::to_string(n) +
+        " dims of a tensor of shape: " + this->tensor_shape_str());
+  }
+  std::vector<int> new_shape(n);
+  std::vector<int> new_strides(n);
+  for (size_t d = 0; d < n; d++) {
+    new_shape[d] = this->shape[dims[d]];
+    new_strides[d] = this->strides[dims[d]];
+  }
+  return make_view(std::move(new_shape), std::move(new_strides), 0);
+}
+
+std::shared_ptr<Tensor> Tensor::slice(int dim, int start, int end, int step) {
+  if (dim < 0 || dim >= int(this->shape.size())) {
+    throw std::invalid_argument(
+        "slice: dim must be in [0, " + std::to_string(this->shape.size()) +
+        "). Got: " + std::to_string(dim));
+  }
+  if (start < 0 || start > end || end > this->shape[dim] || step < 1) {
+    throw std::invalid_argument(
+        "slice: expects 0 <= start <= end <= " +
+        std::to_string(this->shape[dim]) + " and step >= 1. Got: start=" +
+        std::to_string(start) + ", end=" + std::to_string(end) +
+        ", step=" + std::to_string(step));
+  }
+  std::vector<int> new_shape = this->shape;
+  std::vector<int> new_strides = this->strides;
+  new_shape[dim] = (end - start + step - 1) / step;
+  new_strides[dim] *= step;
+  return make_view(
+      std::move(new_shape), std::move(new_strides), start * this->strides[dim]);
+}
+
+std::shared_ptr<Tensor> Tensor::squeeze() {
+  std::vector<int> new_shape;
+  std::vector<int> new_strides;
+  for (size_t d = 0; d < this->shape.size(); d++) {
+    if (this->shape[d] != 1) {
+      new_shape.push_back(this->shape[d]);
+      new_strides.push_back(this->strides[d]);
+    }
+  }
+  if (new_shape.empty()) {
+    // no 0-d tensors, keep a single element
+    new_shape = {1};
+    new_strides = {1};
+  }
+  return make_view(std::move(new_shape), std::move(new_strides), 0);
+}
+
+std::shared_ptr<Tensor> Tensor::squeeze(int dim) {
+  if (dim < 0 || dim >= int(this->shape.size()) || this->shape[dim] != 1 ||
+      this->shape.size() == 1) {
+    throw std::invalid_argument(
+        "squeeze: dim " + std::to_string(dim) +
+        " isn't a dim of size 1 that can be dropped, for shape: " +
+        this->tensor_shape_str());
+  }
+  std::vector<int> new_shape = this->shape;
+  std::vector<int> new_strides = this->strides;
+  new_shape.erase(new_shape.begin() + dim);
+  new_strides.erase(new_strides.begin() + dim);
+  return make_view(std::move(new_shape), std::move(new_strides), 0);
+}
+
+std::shared_ptr<Tensor> Tensor::unsqueeze(int dim) {
+  if (dim < 0 || dim > int(this->shape.size())) {
+    throw std::invalid_argument(
+        "unsqueeze: dim must be in [0, " +
+        std::to_string(this->shape.size()) +
+        "]. Got: " + std::to_string(dim));
+  }
+  // any stride works for a dim of size 1, pick the row-major one
+  int stride = dim < int(this->shape.size())
+      ? this->strides[dim] * this->shape[dim]
+      : 1;
+  std::vector<int> new_shape = this->shape;
+  std::vector<int> new_strides = this->strides;
+  new_shape.insert(new_shape.begin() + dim, 1);
+  new_strides.insert(new_strides.begin() + dim, stride);
+  return make_view(std::move(new_shape), std::move(new_strides), 0);
+}
@@ -1,32 +1,128 @@
 #pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
+#include "grad_mode.h"
+#include "storage.h"
+#include "strided.h"
+#include "teardown.h"
 #include "value.h"
 
+class LazyTensor;
+
 class Tensor : public std::enable_shared_from_this<Tensor> {
+private:
+  // backward closure of the tensor-op that produced this tensor. It reads
+  // `this->grad` and accumulates into the `grad` buffers of `_prev`.
+  std::function<void()> backward_ = nullptr;
+
+  // recomputes `data` from the current data of `_prev`, so a captured graph
+  // can be replayed on new inputs (see CapturedStep)
+  std::function<void()> forward_ = nullptr;
+
+  // last backward pass that visited this tensor, replaces a visited set
+  uint64_t _epoch = 0;
+
+  // index in the topo list of the running backward pass
+  size_t _topo_pos = 0;
+
+  // keeps this tensor alive during a backward pass that doesn't retain the
+  // graph, from the time its consumers are released until its own step
+  std::shared_ptr<Tensor> _hold = nullptr;
+
+  static void build_topo(
+      const std::vector<std::shared_ptr<Tensor>>& roots,
+      std::vector<Tensor*>& topo_list);
+
+  // runs the closures of `topo_list` on the thread pool. Returns false,
+  // without running anything, if the graph has no independent branches.
+  static bool backward_parallel(
+      const std::vector<std::shared_ptr<Tensor>>& roots,
+      const std::vector<Tensor*>& topo_list,
+      bool retain_graph);
+
+  // view of this tensor's storage with its own shape & strides, `offset`
+  // elements in. Backward scatters the view's grad into this tensor's.
+  std::shared_ptr<Tensor>
+  make_view(std::vector<int> shape, std::vector<int> strides, int offset);
+
+  // elementwise binary op with broadcasting, see tensor.cc
+  template <class F, class DA, class DB>
+  std::shared_ptr<Tensor>
+  broadcast_op(std::shared_ptr<Tensor> other, char op, F f, DA da, DB db);
+
+  // sum (or mean, with op 'a') over `dims`, see tensor.cc
+  std::shared_ptr<Tensor>
+  reduce_sum(const std::vector<int>& dims, bool keepdim, char op);
+
+  // softmax (or log-softmax) over `dims`, see tensor.cc
+  std::shared_ptr<Tensor> softmax_over(const std::vector<int>& dims, bool log);
+
+  [[noreturn]] void throw_bad_index(const int* idx, size_t n) const;
+
+  friend class CapturedStep;
+
 public:
   std::vector<int> shape;
-  std::vector<int> strides; // jump each index needs to make
-  std::vector<std::shared_ptr<Value>> v;
+  std::vector<int> strides; // jump each index needs to make, in `data`
+  // elements, row-major unless this is a (non contiguous) view. May share
+  // its buffer with other tensors.
+  Storage data;
+  // always contiguous & row-major (even for views), allocated on backward.
+  // Like `data`, views of it (from Python) may keep its buffer alive.
+  Storage grad;
   int maxIdx = 0;
   int minIdx = 0;
+  std::vector<std::shared_ptr<Tensor>> _prev = {};
+  char _op = '-'; // the tensor-op that produced this tensor
 
-  Tensor(std::vector<int> shape) : shape(std::move(shape)) {
+  // whether backward computes a gradient for this tensor. Off for inputs &
+  // labels, on for layer parameters; an op's output requires grad if any of
+  // its inputs does.
+  bool requires_grad = false;
+
+  Tensor(std::vector<int> shape) : Tensor(std::move(shape), Uninitialized{}) {
+    std::fill(this->data.begin(), this->data.end(), 0.0);
+  }
+
+  // elements left unset, for an op's output that writes all of them
+  Tensor(std::vector<int> shape, Uninitialized) : shape(std::move(shape)) {
     int total_size = 1;
     for (auto& e : this->shape) {
       total_size *= e;
     }
-    v.resize(total_size);
+    data = Storage(total_size, Uninitialized{});
 
     this->compute_stride();
   }
 
-  ~Tensor(){
+  // a view: `data` is laid out by `strides`
+  Tensor(std::vector<int> shape, std::vector<int> strides, Storage data)
+      : shape(std::move(shape)),
+        strides(std::move(strides)),
+        data(std::move(data)) {
+    this->minIdx = 0;
+    this->maxIdx = int(this->numel()) - 1;
+  }
+
+  ~Tensor() {
     this->strides.clear();
     this->shape.clear();
-    this->v.clear();
+    this->data.clear();
+    this->grad.clear();
+    // released one at a time, so dropping a long chain doesn't recurse
+    for (auto& input : this->_prev) {
+      Teardown<Tensor>::release(std::move(input));
+    }
+    this->_prev.clear();
+    this->clearBackwardMethod();
   }
 
   void compute_stride() {
@@ -45,25 +141,40 @@ public:
     this->maxIdx--; // 1 less
   }
 
-  void reshape(std::vector<int> new_shape){
-    int total_ele = 1;
-    for(auto &e:new_shape){
-      total_ele*=e;
+  size_t numel() const {
+    size_t n = 1;
+    for (auto& e : this->shape) {
+      n *= e;
     }
-    if(total_ele!=this->maxIdx +1 ){
-      throw std::runtime_error("New shape must be able to contain ("
-        + std::to_string(this->maxIdx+1)
-        + "), but new shape can handle: "
-        + std::to_string(total_ele)
-        + " elements." 
-      );
+    return n;
+  }
+
+  // whether `data` is row-major, with no gaps
+  bool is_contiguous() const {
+    int expected = 1;
+    for (int d = int(this->shape.size()) - 1; d >= 0; d--) {
+      if (this->shape[d] != 1 && this->strides[d] != expected) {
+        return false;
+      }
+      expected *= this->shape[d];
     }
+    return true;
+  }
 
-    this->shape = new_shape;
-    this->compute_stride();
+  // position in `data` of the i-th element (row-major)
+  int position(int idx) {
+    if (this->is_contiguous()) {
+      return idx;
+    }
+    int pos = 0;
+    for (int d = int(this->shape.size()) - 1; d >= 0; d--) {
+      pos += (idx % this->shape[d]) * this->strides[d];
+      idx /= this->shape[d];
+    }
+    return pos;
   }
 
-  std::string tensor_shape_str() {
+  std::string tensor_shape_str() const {
     std::string shape_str = "(";
     for (auto& e : this->shape) {
       shape_str += std::to_string(e) + ", ";
@@ -72,290 +183,281 @@ public:
     return shape_str;
   }
 
-  void set(std::vector<int> idx, std::shared_ptr<Value> _v) {
-    int original_idx = normalize_idx(idx);
-    if ((original_idx < this->minIdx) || (original_idx > this->maxIdx)) {
-      std::string error_msg =
-          "Tensor set method: Index must be in the range. Limit (" +
-          std::to_string(this->minIdx) + "," + std::to_string(this->maxIdx) +
-          "), but found: " + std::to_string(original_idx) + ".";
-
-      throw std::runtime_error(error_msg);
-    }
-    this->v[original_idx] = _v;
+  // ----- Value compatibility shim -----
+  // `set` copies the data of `_v` into the buffer, and `get` returns a fresh
+  // Value holding a snapshot of the element's data & grad. Calling
+  // `backward()` on that Value (or on any Value computed from it) backprops
+  // into this tensor's graph.
+  void set(const std::vector<int>& idx, std::shared_ptr<Value> _v) {
+    this->set(normalize_idx(idx), std::move(_v));
   }
 
-  std::shared_ptr<Value> get(std::vector<int> idx) {
-    int original_idx = normalize_idx(idx);
-    if ((original_idx < this->minIdx) || (original_idx > this->maxIdx)) {
-      std::string error_msg =
-          "Tensor get method: Index must be in the range. Limit (" +
-          std::to_string(this->minIdx) + "," + std::to_string(this->maxIdx) +
-          "), but found: " + std::to_string(original_idx) + ".";
+  std::shared_ptr<Value> get(const std::vector<int>& idx) {
+    return this->get(normalize_idx(idx));
+  }
 
-      throw std::runtime_error(error_msg);
-    }
-    return this->v[original_idx];
+  // real index. Only the number is copied, so a Value with a graph behind
+  // it (whose gradient would be lost) is refused.
+  void set(int idx, std::shared_ptr<Value> _v) {
+    check_idx(idx, "set");
+    check_no_graph(*_v, "set");
+    this->data[this->position(idx)] = _v->data;
   }
 
   // real index
-  void set(int idx, std::shared_ptr<Value> _v) {
-    if ((idx < this->minIdx) || (idx > this->maxIdx)) {
-      std::string error_msg =
-          "Tensor set method: Index must be in the range. Limit (" +
-          std::to_string(this->minIdx) + "," + std::to_string(this->maxIdx) +
-          "), but found: " + std::to_string(idx) + ".";
+  std::shared_ptr<Value> get(int idx) {
+    check_idx(idx, "get");
+    std::shared_ptr<Value> out =
+        std::make_shared<Value>(this->data[this->position(idx)]);
+    if (!this->grad.empty()) {
+      out->grad = this->grad[idx];
+    }
+    out->requires_grad = this->requires_grad;
+    // tensors not owned by a shared_ptr can't be backpropagated into
+    out->set_tensor(weak_from_this().lock(), idx);
+    return out;
+  }
 
-      throw std::runtime_error(error_msg);
+  // tensor ops take scalar Values as leaves: they can't backprop into the
+  // Value's own graph
+  void check_no_graph(Value& v, const std::string& method) {
+    if (GradMode::is_enabled() && v.requires_grad && v.has_graph()) {
+      throw std::runtime_error(
+          "Tensor " + method +
+          " method: the Value is part of a graph its gradient can't reach. "
+          "Use a Value of its data (or set requires_grad = false).");
     }
-    this->v[idx] = _v;
   }
 
-  // real index
-  std::shared_ptr<Value> get(int idx) {
+  void check_idx(int idx, const std::string& method) {
     if ((idx < this->minIdx) || (idx > this->maxIdx)) {
-      std::string error_msg =
-          "Tensor get method: Index must be in the range. Limit (" +
+      std::string error_msg = "Tensor " + method +
+          " method: Index must be in the range. Limit (" +
           std::to_string(this->minIdx) + "," + std::to_string(this->maxIdx) +
           "), but found: " + std::to_string(idx) + ".";
 
       throw std::runtime_error(error_msg);
     }
-    return this->v[idx];
   }
 
   unsigned dims() {
     return this->shape.size();
   }
 
-  int normalize_idx(std::vector<int> idx);
+  int normalize_idx(const std::vector<int>& idx);
 
-  // tensor specific operations (so layers can directly call them)
-  void zero_grad() {
-    for (auto& e : this->v) {
-      e->grad = 0;
-    }
+  // ----- element access -----
+  // element (i, j, ...) of a tensor of that rank, views included. Checked,
+  // but nothing is allocated unless it throws, so it's fine in inner loops.
+  template <class... Idx>
+  double& at(Idx... idx) {
+    return this->data[this->offset_of(idx...)];
   }
 
-  void remove_redundant_rows(std::shared_ptr<Tensor> t) {
-    // remove redundant rows(1)
-    std::vector<int> new_shape = {};
-    for (auto& e : t->shape) {
-      if (e > 1) {
-        new_shape.push_back(e);
-      }
-    }
-    if (new_shape.size() == 0) {
-      new_shape.push_back(1);
-    }
-    t->shape = new_shape;
-    t->compute_stride();
+  template <class... Idx>
+  double at(Idx... idx) const {
+    return this->data[this->offset_of(idx...)];
   }
 
-  std::shared_ptr<Tensor> add(std::shared_ptr<Tensor> other) {
-    remove_redundant_rows(shared_from_this());
-    remove_redundant_rows(other);
-
-    if (this->shape != other->shape) {
-      std::string this_shape_str = "(";
-      for (auto& e : this->shape) {
-        this_shape_str += std::to_string(e) + ", ";
+  // position in `data` of element (i, j, ...)
+  template <class... Idx>
+  int offset_of(Idx... idx) const {
+    static_assert(sizeof...(Idx) > 0, "offset_of needs an index per dim");
+    const int i[] = {int(idx)...};
+    size_t n = sizeof...(Idx);
+    if (n != this->shape.size()) {
+      this->throw_bad_index(i, n);
+    }
+    int pos = 0;
+    for (size_t d = 0; d < n; d++) {
+      if (i[d] < 0 || i[d] >= this->shape[d]) {
+        this->throw_bad_index(i, n);
       }
-      this_shape_str += ")";
-
-      std::string other_shape_str = "(";
-      for (auto& e : other->shape) {
-        other_shape_str += std::to_string(e) + ", ";
-      }
-      other_shape_str += ")";
-
-      throw std::runtime_error(
-          "Tensors must have the same shape for addition. Got shapes: " +
-          this_shape_str + " and " + other_shape_str);
-    }
-
-    std::shared_ptr<Tensor> out = std::make_shared<Tensor>(other->shape);
-
-    for (int i = 0; i < this->v.size(); i++) {
-      std::shared_ptr<Value> curr_v = this->get(i)->add(other->get(i));
-      out->set(i, std::move(curr_v));
+      pos += i[d] * this->strides[d];
     }
-    return out;
+    return pos;
   }
 
-  std::shared_ptr<Tensor> div(std::shared_ptr<Value> other) {
-    if (other->data == 0) {
-      throw std::runtime_error("Division is not supported by Value(0)");
-    }
-
-    std::shared_ptr<Tensor> out = std::make_shared<Tensor>(this->shape);
-
-    for (int i = 0; i < this->v.size(); i++) {
-      std::shared_ptr<Value> curr_v = this->get(i)->div(other);
-      out->set(i, std::move(curr_v));
-    }
-    return out;
+  // the elements in row-major order, of a view too:
+  //   for (double& v : t->elements()) { ... }
+  StridedRange<double> elements() {
+    return StridedRange<double>(
+        this->data.data(), this->shape, this->strides, this->numel());
   }
 
-  std::shared_ptr<Tensor> matmul(std::shared_ptr<Tensor> other) {
-    if (!other) {
-      throw std::runtime_error("Cannot perform matmul with a null tensor.");
-    }
+  StridedRange<const double> elements() const {
+    return StridedRange<const double>(
+        this->data.data(), this->shape, this->strides, this->numel());
+  }
 
-    if (this->shape.size() > 2 || other->shape.size() > 2) {
-      throw std::runtime_error("For now, only 2-D matmul is allowed");
-    }
+  // ----- autograd -----
+  // called by an op on its output: the graph is only recorded (`_prev` and
+  // closures) when grad mode is on and some input requires grad, or when a
+  // step is being captured. Either way `requires_grad` is set from the
+  // inputs.
+  bool record_grad_from(std::initializer_list<const Tensor*> inputs) {
+    return this->record_grad_from(inputs.begin(), inputs.end());
+  }
 
-    // Determine effective shapes
-    std::vector<int> this_shape = this->shape;
-    std::vector<int> other_shape = other->shape;
+  bool record_grad_from(const std::vector<const Tensor*>& inputs) {
+    return this->record_grad_from(
+        inputs.data(), inputs.data() + inputs.size());
+  }
 
-    // Reshape if either is a vector (1D tensor)
-    if (this_shape.size() == 1) {
-      std::vector<int> new_shape = {1, this_shape[0]};
-      this->shape = new_shape;
-      this->compute_stride();
-      this_shape = new_shape;
+  bool record_grad_from(const Tensor* const* first, const Tensor* const* last) {
+    if (!GradMode::is_enabled()) {
+      return false;
     }
-    if (other_shape.size() == 1) {
-      // other_shape.push_back(1); // Treat as column vector
-      // other->shape.push_back(1);
-      // this->recompute_stride();
-
-      throw std::runtime_error("other tensor can't be 1D for matmul.");
-    }
-
-    // Validate dimensions for matrix multiplication
-    if (this->shape[1] != other_shape[0]) {
-      throw std::runtime_error(
-          "Dimensions do not align for matmul. Got shapes: (" +
-          std::to_string(this_shape[0]) + ", " + std::to_string(this_shape[1]) +
-          ") and (" + std::to_string(other_shape[0]) + ", " +
-          std::to_string(other_shape[1]) + ")");
+    for (; first != last; first++) {
+      this->requires_grad = this->requires_grad || (*first)->requires_grad;
     }
+    return this->requires_grad || GradMode::is_capturing();
+  }
 
-    // Compute output shape
-    std::vector<int> output_shape = {this_shape[0], other->shape[1]};
-    std::shared_ptr<Tensor> out = std::make_shared<Tensor>(output_shape);
-
-    // Perform matrix multiplication
-    for (int i = 0; i < output_shape[0]; i++) {
-      for (int j = 0; j < output_shape[1]; j++) {
-        std::shared_ptr<Value> sum = std::make_shared<Value>(0);
-        for (int k = 0; k < this_shape[1]; k++) {
-          sum = sum->add(this->get({i, k})->mul(other->get({k, j})));
-        }
-        out->set({i, j}, sum);
-      }
+  void setBackWardMethod(std::function<void()> func) {
+    // recorded only to be replayed: no gradient flows through it
+    if (this->requires_grad) {
+      this->backward_ = std::move(func);
     }
-
-    return out;
   }
 
-  // non-linear layers in tesor
-  std::shared_ptr<Tensor> relu() {
-    std::shared_ptr<Tensor> out = std::make_shared<Tensor>(this->shape);
-    int i = 0;
-    for (auto& e : this->v) {
-      std::shared_ptr<Value> curr = e->relu();
-      out->set(i, curr);
-      i++;
-    }
-    return out;
+  void setForwardMethod(std::function<void()> func) {
+    this->forward_ = std::move(func);
   }
 
-  std::shared_ptr<Tensor> tanh() {
-    std::shared_ptr<Tensor> out = std::make_shared<Tensor>(this->shape);
-    int i = 0;
-    for (auto& e : this->v) {
-      std::shared_ptr<Value> curr = e->tanh();
-      out->set(i, curr);
-      i++;
+  void executeForwardMethod() {
+    if (this->forward_) {
+      this->forward_();
     }
-    return out;
   }
 
-  std::shared_ptr<Tensor> gelu() {
-    std::shared_ptr<Tensor> out = std::make_shared<Tensor>(this->shape);
-    int i = 0;
-    for (auto& e : this->v) {
-      std::shared_ptr<Value> curr = e->gelu();
-      out->set(i, curr);
-      i++;
+  void executeBackWardMethod() {
+    if (this->backward_) {
+      this->backward_();
     }
-    return out;
   }
 
-  std::shared_ptr<Tensor> sigmoid() {
-    std::shared_ptr<Tensor> out = std::make_shared<Tensor>(this->shape);
-    int i = 0;
-    for (auto& e : this->v) {
-      std::shared_ptr<Value> curr = e->sigmoid();
-      out->set(i, curr);
-      i++;
-    }
-    return out;
+  void clearBackwardMethod() {
+    this->backward_ = nullptr;
+    this->forward_ = nullptr;
   }
 
-  std::shared_ptr<Tensor> leakyRelu(double alpha) {
-    std::shared_ptr<Tensor> out = std::make_shared<Tensor>(this->shape);
-    int i = 0;
-    for (auto& e : this->v) {
-      std::shared_ptr<Value> curr = e->leakyRelu(alpha);
-      out->set(i, curr);
-      i++;
-    }
-    return out;
+  bool is_leaf() {
+    return this->backward_ == nullptr;
   }
 
-  std::shared_ptr<Tensor> softmax() {
-    // Step 1: Find the maximum value for numerical stability
-    auto max_val = *std::max_element(
-        this->v.begin(),
-        this->v.end(),
-        [](const std::shared_ptr<Value>& a, const std::shared_ptr<Value>& b) {
-          return a->data < b->data;
-        });
-    // Step 2: Compute exp(x_i - max_val) for each input
-    std::shared_ptr<Tensor> exp_vals = std::make_shared<Tensor>(this->shape);
-
-    int i = 0;
-    for (auto& val : this->v) {
-      auto curr_exp_val = val->sub(max_val)->exp();
-      exp_vals->set(i, curr_exp_val);
-      i++;
-    }
+  // backprop with a gradient of ones for every element of this tensor
+  void backward(bool retain_graph = true);
+
+  // backprop from several roots at once, each seeded with its own gradient
+  // buffer (same layout as the root's data). Leaf grads accumulate across
+  // calls; the grads of intermediate tensors only hold the latest pass.
+  //
+  // With `retain_graph` false the graph is consumed as the pass goes: once a
+  // tensor's closure has run, its closures, `_prev` and (unless it's a root)
+  // grad buffer are released, so intermediate tensors nobody else holds are
+  // freed before backward returns.
+  static void backward(
+      const std::vector<std::shared_ptr<Tensor>>& roots,
+      const std::vector<std::vector<double>>& root_grads,
+      bool retain_graph = true);
 
-    // Step 3: Compute the sum of exp(x_i - max_val)
-    std::shared_ptr<Value> sum_exp = std::make_shared<Value>(0.0);
-    for (int i = 0; i <= exp_vals->maxIdx; i++) {
-      sum_exp = sum_exp->add(exp_vals->get(i));
-    }
+  // tensor specific operations (so layers can directly call them)
+  void zero_grad() {
+    this->grad.assign(this->numel(), 0.0);
+  }
 
-    // Step 4: Compute softmax = exp(x_i - max_val) / sum_exp
-    std::shared_ptr<Tensor> softmax_vals =
-        std::make_shared<Tensor>(this->shape);
+  // elementwise, with numpy broadcasting
+  std::shared_ptr<Tensor> add(std::shared_ptr<Tensor> other);
+  std::shared_ptr<Tensor> sub(std::shared_ptr<Tensor> other);
+  std::shared_ptr<Tensor> mul(std::shared_ptr<Tensor> other);
+  std::shared_ptr<Tensor> div(std::shared_ptr<Tensor> other);
+  std::shared_ptr<Tensor> maximum(std::shared_ptr<Tensor> other);
 
-    for (int i = 0; i <= softmax_vals->maxIdx; i++) {
-      softmax_vals->set(i, exp_vals->get(i)->div(sum_exp));
-    }
+  std::shared_ptr<Tensor> div(std::shared_ptr<Value> other);
+  std::shared_ptr<Tensor> matmul(std::shared_ptr<Tensor> other);
 
-    return softmax_vals;
-  }
+  // elementwise ops on this tensor, recorded to run fused (see LazyTensor)
+  std::shared_ptr<LazyTensor> lazy();
+
+  // non-linear layers in tesor
+  std::shared_ptr<Tensor> relu();
+  std::shared_ptr<Tensor> tanh();
+  std::shared_ptr<Tensor> gelu();
+  std::shared_ptr<Tensor> sigmoid();
+  std::shared_ptr<Tensor> leakyRelu(double alpha);
+  // over the whole tensor, or along `dim`
+  std::shared_ptr<Tensor> softmax();
+  std::shared_ptr<Tensor> softmax(int dim);
+  // log(softmax(x)) along `dim`, without forming softmax(x)
+  std::shared_ptr<Tensor> log_softmax(int dim);
+
+  // ----- reductions -----
+  // over `dims`, all of them if empty. The reduced dims are dropped, or
+  // kept with size 1 with `keepdim`; reducing every dim gives shape (1).
+  std::shared_ptr<Tensor> sum(std::vector<int> dims = {}, bool keepdim = false);
+  std::shared_ptr<Tensor> mean(
+      std::vector<int> dims = {},
+      bool keepdim = false);
+  // the gradient goes to the first max
+  std::shared_ptr<Tensor> max(
+      std::vector<int> dims = {},
+      bool keepdim = false);
+  // row-major index of the first max within the reduced dims (along `dim`
+  // for a single one, into the flattened tensor for all). Not differentiable.
+  std::shared_ptr<Tensor> argmax(
+      std::vector<int> dims = {},
+      bool keepdim = false);
+  // sum((x - mean)^2) / (n - correction), n the elements reduced
+  std::shared_ptr<Tensor> var(
+      std::vector<int> dims = {},
+      bool keepdim = false,
+      int correction = 1);
 
   std::string printMe() {
     std::string my_shape = "tensor of shape: " + tensor_shape_str();
     return my_shape;
   }
 
-  std::shared_ptr<Tensor> flatten() {
-    std::shared_ptr<Tensor> out =
-        std::make_shared<Tensor>(std::vector<int>{maxIdx + 1});
-    int i = 0;
-    for (auto& e : this->v) {
-      out->set(i, e);
-      i++;
-    }
-    return out;
-  }
+  // ----- views -----
+  // O(1): they share this tensor's storage. Ops (and layers) copy a view
+  // that isn't contiguous first, through `contiguous`.
+  std::shared_ptr<Tensor> contiguous();
+  std::shared_ptr<Tensor> reshape(std::vector<int> new_shape);
+  std::shared_ptr<Tensor> flatten();
+  std::shared_ptr<Tensor> transpose(int dim0, int dim1);
+  std::shared_ptr<Tensor> permute(std::vector<int> dims);
+  // elements [start, end) of `dim`, every `step`-th one
+  std::shared_ptr<Tensor> slice(int dim, int start, int end, int step = 1);
+  // drop the dims of size 1 (all of them, or just `dim`)
+  std::shared_ptr<Tensor> squeeze();
+  std::shared_ptr<Tensor> squeeze(int dim);
+  // insert a dim of size 1 at `dim`
+  std::shared_ptr<Tensor> unsqueeze(int dim);
+};
+
+/// GradLock
+/// Locks the grads of a closure's inputs while it accumulates into them, so
+/// two consumers of the same tensor running on different threads don't race.
+/// Tensors map to a fixed set of stripes, locked in order (no deadlock). The
+/// parallel backward pass holds it around every closure, and closures built
+/// outside tensor.cc (like a checkpoint's) take it for the grads they write.
+class GradLock {
+private:
+  std::vector<size_t> stripes_;
+
+  void lock_all();
+
+public:
+  explicit GradLock(const std::vector<std::shared_ptr<Tensor>>& inputs);
+  explicit GradLock(std::initializer_list<const Tensor*> inputs);
+  ~GradLock();
+
+  GradLock(const GradLock&) = delete;
+  GradLock& operator=(const GradLock&) = delete;
+
+  // for a scalar Value a closure accumulates into (it isn't in `_prev`).
+  // Its own set of stripes, taken after the tensor ones and alone, so it
+  // can't deadlock with them.
+  static std::mutex& value_stripe(const Value* v);
 };
@@ -0,0 +1,198 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// pool & worker index of the calling thread, if it's a worker
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  num_threads = std::max<size_t>(num_threads, 1);
+  for (size_t i = 0; i < num_threads; i++) {
+    this->workers_.push_back(std::make_unique<Worker>());
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    this->threads_.emplace_back([this, i]() { this->run_worker(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(this->sleep_mutex_);
+    this->stop_ = true;
+  }
+  this->sleep_cv_.notify_all();
+  for (auto& t : this->threads_) {
+    t.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  size_t index = current_pool == this
+      ? current_worker
+      : this->next_worker_++ % this->workers_.size();
+  {
+    Worker& w = *this->workers_[index];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    w.tasks.push_back(std::move(task));
+  }
+  {
+    // under the sleep mutex, so a worker can't miss it between checking
+    // `queued_` and going to sleep
+    std::lock_guard<std::mutex> lock(this->sleep_mutex_);
+    this->queued_++;
+  }
+  this->sleep_cv_.notify_one();
+}
+
+bool ThreadPool::pop_task(size_t index, std::function<void()>& task) {
+  size_t n = this->workers_.size();
+  for (size_t k = 0; k < n; k++) {
+    Worker& w = *this->workers_[(index + k) % n];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (w.tasks.empty()) {
+      continue;
+    }
+    if (k == 0) {
+      // own deque: newest first
+      task = std::move(w.tasks.back());
+      w.tasks.pop_back();
+    } else {
+      // steal the oldest task of another worker
+      task = std::move(w.tasks.front());
+      w.tasks.pop_front();
+    }
+    this->queued_--;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::run_worker(size_t index) {
+  current_pool = this;
+  current_worker = index;
+
+  std::function<void()> task;
+  while (true) {
+    if (this->pop_task(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(this->sleep_mutex_);
+    this->sleep_cv_.wait(
+        lock, [this]() { return this->stop_ || this->queued_ > 0; });
+    if (this->stop_ && this->queued_ == 0) {
+      return;
+    }
+  }
+}
+
+bool ThreadPool::on_worker() {
+  return current_pool != nullptr;
+}
+
+static size_t default_threads() {
+  return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+static std::unique_ptr<ThreadPool>& global_pool() {
+  static std::unique_ptr<ThreadPool> pool =
+      std::make_unique<ThreadPool>(default_threads());
+  return pool;
+}
+
+ThreadPool& ThreadPool::global() {
+  return *global_pool();
+}
+
+void ThreadPool::set_global_threads(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = default_threads();
+  }
+  std::unique_ptr<ThreadPool>& pool = global_pool();
+  if (pool->size() != num_threads) {
+    pool = std::make_unique<ThreadPool>(num_threads);
+  }
+}
+
+void parallel_for(
+    size_t begin,
+    size_t end,
+    size_t grain,
+    const std::function<void(size_t, size_t)>& fn) {
+  if (begin >= end) {
+    return;
+  }
+  size_t n = end - begin;
+  size_t threads = ThreadPool::global().size();
+  grain = std::max<size_t>(grain, 1);
+  if (n <= grain || threads < 2) {
+    fn(begin, end);
+    return;
+  }
+
+  // one chunk per thread, unless that's below the grain
+  size_t chunk = std::max(grain, (n + threads - 1) / threads);
+  size_t num_chunks = (n + chunk - 1) / chunk;
+
+  struct Job {
+    std::atomic<size_t> next{0}; // next chunk to take
+    std::atomic<size_t> done{0};
+    std::mutex mutex; // guards `error`, and the wake up of the caller
+    std::condition_variable cv;
+    std::exception_ptr error = nullptr;
+  };
+  auto job = std::make_shared<Job>();
+
+  // a helper that starts after every chunk is taken returns without
+  // touching `fn`, so it may outlive this call
+  auto run = [job, &fn, begin, end, chunk, num_chunks]() {
+    size_t c;
+    while ((c = job->next++) < num_chunks) {
+      size_t lo = begin + c * chunk;
+      try {
+        fn(lo, std::min(end, lo + chunk));
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if (job->error == nullptr) {
+          job->error = std::current_exception();
+        }
+      }
+      if (++job->done == num_chunks) {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->cv.notify_all();
+      }
+    }
+  };
+
+  ThreadPool& pool = ThreadPool::global();
+  for (size_t i = 1; i < std::min(threads, num_chunks); i++) {
+    pool.submit(run);
+  }
+  run();
+
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->cv.wait(lock, [&]() { return job->done == num_chunks; });
+  if (job->error != nullptr) {
+    std::rethrow_exception(job->error);
+  }
+}
+
+void set_num_threads(int num_threads) {
+  if (num_threads < 0) {
+    throw std::invalid_argument(
+        "set_num_threads expects a non-negative count. Got: " +
+        std::to_string(num_threads));
+  }
+  ThreadPool::set_global_threads(num_threads);
+}
+
+int get_num_threads() {
+  return int(ThreadPool::global().size());
+}
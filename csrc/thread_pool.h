@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// ThreadPool
+/// Work-stealing pool. Every worker owns a deque of tasks:
+/// - a task submitted from a worker goes to the back of that worker's deque,
+///   and the worker pops its own deque from the back (the newest task, whose
+///   data is likely still in cache).
+/// - a task submitted from outside the pool goes round-robin to the workers.
+/// - a worker with an empty deque steals from the front of the others.
+/// Idle workers sleep until something is queued.
+class ThreadPool {
+private:
+  struct Worker {
+    std::mutex mutex; // guards `tasks`
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> queued_{0}; // tasks submitted but not yet picked up
+  std::atomic<size_t> next_worker_{0}; // round-robin for outside submits
+
+  std::mutex sleep_mutex_; // guards `stop_`, and the wake up of idle workers
+  std::condition_variable sleep_cv_;
+  bool stop_ = false;
+
+  void run_worker(size_t index);
+  bool pop_task(size_t index, std::function<void()>& task);
+
+public:
+  explicit ThreadPool(size_t num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void submit(std::function<void()> task);
+
+  size_t size() {
+    return this->threads_.size();
+  }
+
+  // whether the calling thread is a worker of some pool. Work that would
+  // block on the pool (like a nested backward pass) runs inline there.
+  static bool on_worker();
+
+  // pool shared by the library, one worker per core by default
+  static ThreadPool& global();
+
+  // replace the shared pool with one of `num_threads` workers (the default
+  // with 0). Not safe while work is running on the old one.
+  static void set_global_threads(size_t num_threads);
+};
+
+/// parallel_for
+/// Calls fn(lo, hi) over chunks of [begin, end), at least `grain` long, on
+/// the shared pool and the calling thread, and returns once all of them are
+/// done. A range of at most `grain` (or a pool of a single thread) runs
+/// inline, so `grain` is what keeps tiny tensors off the pool.
+///
+/// The caller takes chunks too, and only waits on chunks other threads have
+/// started, so it's safe on a worker (a backward closure, a nested loop). An
+/// exception thrown by `fn` is rethrown here.
+void parallel_for(
+    size_t begin,
+    size_t end,
+    size_t grain,
+    const std::function<void(size_t, size_t)>& fn);
+
+// threads of the shared pool, used by intra-op parallelism and the parallel
+// backward pass. 0 restores the default (one per core).
+void set_num_threads(int num_threads);
+int get_num_threads();
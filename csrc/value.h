@@ -1,60 +1,168 @@
 #pragma once
-#include <functional>
 #include <memory>
 #include <string>
-#include <unordered_set>
 #include <utility>
 #include <vector>
+#include "tape.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846264338327950288
 #endif
 
+class Tensor;
+
 class Value : public std::enable_shared_from_this<Value> {
 private:
-  //   internal properties
-  // Function pointer for the private method
+  // rarely needed state, allocated on demand so a plain node only pays a
+  // pointer for it
+  struct Extra {
+    // all the inputs of an n-ary node (more than two)
+    std::vector<std::shared_ptr<Value>> inputs;
+    // see `tensor()`
+    std::shared_ptr<Tensor> tensor = nullptr;
+    int tensor_idx = -1;
+  };
+
+  // inputs of the op that produced this node. Up to two are inline, an op
+  // with more keeps all of them in `_extra`. They only keep the inputs
+  // alive, the backward pass itself is driven by the tape.
+  std::shared_ptr<Value> _in[2] = {nullptr, nullptr};
+  std::unique_ptr<Extra> _extra = nullptr;
+
+  Extra& extra() {
+    if (this->_extra == nullptr) {
+      this->_extra = std::make_unique<Extra>();
+    }
+    return *this->_extra;
+  }
 
-  // function type - returns void, and takes no parameter `()`
-  std::function<void()> backward_ = nullptr;
+  // node for `op` applied to this (and `other`, if any), recorded on the tape
+  std::shared_ptr<Value> make_result(
+      double newData,
+      Op op,
+      char op_char,
+      std::shared_ptr<Value> other = nullptr,
+      double saved = 0.0);
 
-  void build_topo(
-      std::shared_ptr<Value> v,
-      std::unordered_set<std::shared_ptr<Value>>& visited,
-      std::vector<std::shared_ptr<Value>>& topo_list);
+  friend class Tape;
 
 public:
   double data = 0.0;
   double grad = 0.0;
-  std::unordered_set<std::shared_ptr<Value>> _prev = {};
-  char _op = '-'; // the op that produced this node
+  // scalar operand of the op, like `n` of pow or `alpha` of leakyRelu, or
+  // what backward would otherwise recompute (tanh of gelu)
+  double saved = 0.0;
+
+  // record of the op that produced this node, -1 for leaves
+  Tape* _tape = nullptr;
+  int _tape_idx = -1;
+
+  Op op = Op::Leaf;
+  char _op = '-'; // the op that produced this node, for printing
+
+  // whether backward computes a gradient for this node. Ops on nodes that
+  // don't require grad build no graph.
+  bool requires_grad = true;
+
+  // set while a backward pass walks the tape
+  bool _reached = false;
 
   Value(double data) : data(data) {}
-  Value(double data, std::unordered_set<std::shared_ptr<Value>> _prev, char _op)
-      : data(data), _prev(std::move(_prev)), _op(_op) {}
-  
-  ~Value(){
-    this->_prev.clear();
-    this->clearBackwardMethod();
+  Value(double data, std::vector<std::shared_ptr<Value>> _prev, char _op)
+      : data(data), _op(_op) {
+    this->set_inputs(std::move(_prev));
   }
 
-  // Setter to assign a new function
-  void setBackWardMethod(std::function<void()> func) {
-    this->backward_ = func;
+  // the inputs are released through `Teardown`, so dropping a long chain
+  // doesn't recurse through it
+  ~Value();
+
+  void set_inputs(std::vector<std::shared_ptr<Value>> inputs) {
+    this->_in[0] = nullptr;
+    this->_in[1] = nullptr;
+    if (inputs.size() <= 2) {
+      for (size_t i = 0; i < inputs.size(); i++) {
+        this->_in[i] = std::move(inputs[i]);
+      }
+      if (this->_extra != nullptr) {
+        this->_extra->inputs.clear();
+      }
+      return;
+    }
+    this->extra().inputs = std::move(inputs);
   }
 
-  // Method to execute the private method backward_
+  size_t num_inputs() {
+    if (this->_extra != nullptr && !this->_extra->inputs.empty()) {
+      return this->_extra->inputs.size();
+    }
+    return (this->_in[0] != nullptr) + (this->_in[1] != nullptr);
+  }
+
+  Value* input(size_t i) {
+    if (this->_extra != nullptr && !this->_extra->inputs.empty()) {
+      return this->_extra->inputs[i].get();
+    }
+    return this->_in[i].get();
+  }
+
+  // copy of the inputs, empty for leaves (and consumed nodes)
+  std::vector<std::shared_ptr<Value>> prev() {
+    if (this->_extra != nullptr && !this->_extra->inputs.empty()) {
+      return this->_extra->inputs;
+    }
+    std::vector<std::shared_ptr<Value>> out;
+    for (auto& in : this->_in) {
+      if (in != nullptr) {
+        out.push_back(in);
+      }
+    }
+    return out;
+  }
+
+  // set for Values handed out by `Tensor::get`: the element they mirror, so
+  // backward can continue into the tensor graph
+  std::shared_ptr<Tensor> tensor() {
+    return this->_extra == nullptr ? nullptr : this->_extra->tensor;
+  }
+
+  // whether a gradient reaching this node would flow on: it's the output of
+  // a recorded op, or it mirrors a tensor element
+  bool has_graph() {
+    return this->_tape_idx >= 0 || this->tensor() != nullptr;
+  }
+
+  int tensor_idx() {
+    return this->_extra == nullptr ? -1 : this->_extra->tensor_idx;
+  }
+
+  void set_tensor(std::shared_ptr<Tensor> tensor, int idx) {
+    if (tensor == nullptr && this->_extra == nullptr) {
+      return;
+    }
+    this->extra().tensor = std::move(tensor);
+    this->_extra->tensor_idx = idx;
+  }
+
+  // apply the chain rule of the op that produced this node (single step)
   void executeBackWardMethod() {
-    if (this->backward_) {
-      this->backward_();
+    if (this->_tape_idx >= 0) {
+      this->_tape->backward_step(this);
     }
   }
 
+  // detach from the tape, making this node a leaf
   void clearBackwardMethod() {
-    this->backward_ = nullptr;
+    if (this->_tape_idx >= 0) {
+      this->_tape->release(this->_tape_idx);
+      this->_tape = nullptr;
+      this->_tape_idx = -1;
+    }
   }
 
-  void backward();
+  // the scalar graph is always consumed. So is the tensor graph behind it
+  // (the activations of a loss), as the pass goes, unless `retain_graph`.
+  void backward(bool retain_graph = false);
 
   std::string printMe() {
     std::string s = "Value(data=" + std::to_string(this->data) +
@@ -85,4 +193,12 @@ public:
   std::shared_ptr<Value> gelu();
   std::shared_ptr<Value> sigmoid();
   std::shared_ptr<Value> leakyRelu(double alpha);
+
+  // n-ary reductions: a single node (and tape record) for all the inputs,
+  // instead of a chain of add/mul nodes
+  static std::shared_ptr<Value> sum(
+      const std::vector<std::shared_ptr<Value>>& values);
+  static std::shared_ptr<Value> dot(
+      const std::vector<std::shared_ptr<Value>>& a,
+      const std::vector<std::shared_ptr<Value>>& b);
 };
@@ -0,0 +1,323 @@
+#include "vmath.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "simd.h"
+
+// The kernels are written once on GCC vector types, as templates over the
+// vector type, and instantiated 2 (baseline), 4 (AVX2) and 8 (AVX-512)
+// lanes wide. Scalars broadcast in mixed expressions.
+
+namespace {
+
+typedef double V2 __attribute__((vector_size(16)));
+typedef int64_t I2 __attribute__((vector_size(16)));
+typedef double V4 __attribute__((vector_size(32)));
+typedef int64_t I4 __attribute__((vector_size(32)));
+typedef double V8 __attribute__((vector_size(64)));
+typedef int64_t I8 __attribute__((vector_size(64)));
+
+template <class V>
+struct IntOf;
+template <>
+struct IntOf<V2> {
+  using type = I2;
+};
+template <>
+struct IntOf<V4> {
+  using type = I4;
+};
+template <>
+struct IntOf<V8> {
+  using type = I8;
+};
+
+#define VMATH_INLINE inline __attribute__((always_inline))
+
+// gelu(x) = 0.5 x (1 + tanh(kGeluScale * (x + kGeluCoeff * x^3)))
+constexpr double kGeluScale = 0.7978845608028654; // sqrt(2 / pi)
+constexpr double kGeluCoeff = 0.044715;
+
+template <class V>
+VMATH_INLINE V exp_v(V x) {
+  using I = typename IntOf<V>::type;
+  constexpr double kMax = 709.782712893384; // ln(DBL_MAX)
+  constexpr double kMin = -708.0;
+  constexpr double kLog2e = 1.4426950408889634;
+  constexpr double kLn2Hi = 0.693147180369123816490; // exact times k
+  constexpr double kLn2Lo = 1.90821492927058770002e-10;
+  constexpr double kRound = 6755399441055744.0; // 2^52 + 2^51
+
+  // x = k ln2 + r. Adding kRound rounds x / ln2 to an integer, and leaves
+  // that integer in the low bits.
+  V xc = x > kMax ? kMax : x;
+  xc = xc < kMin ? kMin : xc;
+  V t = xc * kLog2e + kRound;
+  V k = t - kRound;
+  V r = xc - k * kLn2Hi;
+  r = r - k * kLn2Lo;
+
+  // exp(r), Horner on 1/13!, ..., 1/1!, 1
+  V p = r * (1.0 / 6227020800.0) + 1.0 / 479001600.0;
+  p = p * r + 1.0 / 39916800.0;
+  p = p * r + 1.0 / 3628800.0;
+  p = p * r + 1.0 / 362880.0;
+  p = p * r + 1.0 / 40320.0;
+  p = p * r + 1.0 / 5040.0;
+  p = p * r + 1.0 / 720.0;
+  p = p * r + 1.0 / 120.0;
+  p = p * r + 1.0 / 24.0;
+  p = p * r + 1.0 / 6.0;
+  p = p * r + 0.5;
+  p = p * r + 1.0;
+  p = p * r + 1.0;
+
+  // times 2^(k - 1) times 2: k reaches 1024 near kMax, past the exponent
+  // range, k - 1 doesn't
+  I kk = (I)t - (I)(V{} + kRound);
+  V scale = (V)((kk + 1022) << 52);
+  V y = p * scale * 2.0;
+  y = x > kMax ? HUGE_VAL : y;
+  y = x < kMin ? 0.0 : y;
+  return y;
+}
+
+template <class V>
+VMATH_INLINE V tanh_v(V x) {
+  // Cephes rational approximation, for |x| < 0.625
+  V s = x * x;
+  V p = (s * -9.64399179425052238628e-1 + -9.92877231001918586564e1) * s +
+      -1.61468768441708447952e3;
+  V q = ((s + 1.12811678491632931402e2) * s + 2.23548839060100448583e3) * s +
+      4.84406305325125486048e3;
+  V small = x + x * s * (p / q);
+
+  // 1 - 2 / (exp(2|x|) + 1) beyond. exp overflows to inf for big |x|,
+  // which gives exactly 1.
+  V a = x < 0.0 ? -x : x;
+  V large = 1.0 - 2.0 / (exp_v(a + a) + 1.0);
+  large = x < 0.0 ? -large : large;
+  return a < 0.625 ? small : large;
+}
+
+template <class V>
+VMATH_INLINE V sigmoid_v(V x) {
+  return 1.0 / (1.0 + exp_v(-x));
+}
+
+template <class V>
+VMATH_INLINE V load(const double* p) {
+  V v;
+  std::memcpy(&v, p, sizeof(V));
+  return v;
+}
+
+template <class V>
+VMATH_INLINE void store(double* p, V v) {
+  std::memcpy(p, &v, sizeof(V));
+}
+
+enum class Fn { Exp, Tanh, Sigmoid };
+
+template <Fn F, class V>
+VMATH_INLINE V eval(V x) {
+  if (F == Fn::Exp) {
+    return exp_v(x);
+  }
+  if (F == Fn::Tanh) {
+    return tanh_v(x);
+  }
+  return sigmoid_v(x);
+}
+
+// y[i] = f(x[i]), a full vector at a time, and the tail through a
+// zero-padded copy. No lambdas: they wouldn't get the caller's target.
+template <Fn F, class V>
+VMATH_INLINE void map(const double* x, double* y, size_t n) {
+  constexpr size_t lanes = sizeof(V) / sizeof(double);
+  size_t i = 0;
+  for (; i + lanes <= n; i += lanes) {
+    store(y + i, eval<F>(load<V>(x + i)));
+  }
+  if (i < n) {
+    double buf[lanes] = {};
+    std::memcpy(buf, x + i, (n - i) * sizeof(double));
+    store(buf, eval<F>(load<V>(buf)));
+    std::memcpy(y + i, buf, (n - i) * sizeof(double));
+  }
+}
+
+template <class V>
+VMATH_INLINE void gelu_lanes(
+    const double* x,
+    double* y,
+    double* t,
+    size_t len) {
+  constexpr size_t lanes = sizeof(V) / sizeof(double);
+  double buf[lanes] = {};
+  std::memcpy(buf, x, len * sizeof(double));
+  V v = load<V>(buf);
+  V th = tanh_v(kGeluScale * (v + kGeluCoeff * v * v * v));
+  store(buf, 0.5 * v * (1.0 + th));
+  std::memcpy(y, buf, len * sizeof(double));
+  if (t != nullptr) {
+    store(buf, th);
+    std::memcpy(t, buf, len * sizeof(double));
+  }
+}
+
+template <class V>
+VMATH_INLINE void gelu_impl(const double* x, double* y, double* t, size_t n) {
+  constexpr size_t lanes = sizeof(V) / sizeof(double);
+  size_t i = 0;
+  for (; i + lanes <= n; i += lanes) {
+    gelu_lanes<V>(x + i, y + i, t == nullptr ? nullptr : t + i, lanes);
+  }
+  if (i < n) {
+    gelu_lanes<V>(x + i, y + i, t == nullptr ? nullptr : t + i, n - i);
+  }
+}
+
+// one function per kernel and instruction set, picked at runtime
+#define VMATH_KERNELS(suffix, V, target)                                \
+  target void exp_##suffix(const double* x, double* y, size_t n) {      \
+    map<Fn::Exp, V>(x, y, n);                                           \
+  }                                                                     \
+  target void tanh_##suffix(const double* x, double* y, size_t n) {     \
+    map<Fn::Tanh, V>(x, y, n);                                          \
+  }                                                                     \
+  target void sigmoid_##suffix(const double* x, double* y, size_t n) {  \
+    map<Fn::Sigmoid, V>(x, y, n);                                       \
+  }                                                                     \
+  target void gelu_##suffix(                                            \
+      const double* x, double* y, double* t, size_t n) {                \
+    gelu_impl<V>(x, y, t, n);                                           \
+  }
+
+VMATH_KERNELS(generic, V2, )
+#ifdef DEEPTENSOR_X86_KERNELS
+VMATH_KERNELS(avx2, V4, __attribute__((target("avx2,fma"))))
+VMATH_KERNELS(avx512, V8, __attribute__((target("avx512f"))))
+#endif
+
+struct Kernels {
+  const char* name;
+  void (*exp)(const double*, double*, size_t);
+  void (*tanh)(const double*, double*, size_t);
+  void (*sigmoid)(const double*, double*, size_t);
+  void (*gelu)(const double*, double*, double*, size_t);
+};
+
+const Kernels kGeneric = {
+    "generic",
+    exp_generic,
+    tanh_generic,
+    sigmoid_generic,
+    gelu_generic};
+#ifdef DEEPTENSOR_X86_KERNELS
+const Kernels kAvx2 = {"avx2", exp_avx2, tanh_avx2, sigmoid_avx2, gelu_avx2};
+const Kernels kAvx512 = {
+    "avx512",
+    exp_avx512,
+    tanh_avx512,
+    sigmoid_avx512,
+    gelu_avx512};
+#endif
+
+bool supported(const Kernels& kernels) {
+#ifdef DEEPTENSOR_X86_KERNELS
+  if (&kernels == &kAvx512) {
+    return cpu_has_avx512();
+  }
+  if (&kernels == &kAvx2) {
+    return cpu_has_avx2();
+  }
+#endif
+  return &kernels == &kGeneric;
+}
+
+const Kernels* best_kernels() {
+#ifdef DEEPTENSOR_X86_KERNELS
+  if (supported(kAvx512)) {
+    return &kAvx512;
+  }
+  if (supported(kAvx2)) {
+    return &kAvx2;
+  }
+#endif
+  return &kGeneric;
+}
+
+const Kernels*& active_kernels() {
+  static const Kernels* kernels = best_kernels();
+  return kernels;
+}
+
+} // namespace
+
+std::string vmath_kernel() {
+  return active_kernels()->name;
+}
+
+bool set_vmath_kernel(const std::string& name) {
+  std::vector<const Kernels*> all = {&kGeneric};
+#ifdef DEEPTENSOR_X86_KERNELS
+  all.push_back(&kAvx2);
+  all.push_back(&kAvx512);
+#endif
+  for (const Kernels* kernels : all) {
+    if (name == kernels->name && supported(*kernels)) {
+      active_kernels() = kernels;
+      return true;
+    }
+  }
+  return false;
+}
+
+void vexp(const double* x, double* y, size_t n) {
+  active_kernels()->exp(x, y, n);
+}
+
+void vtanh(const double* x, double* y, size_t n) {
+  active_kernels()->tanh(x, y, n);
+}
+
+void vsigmoid(const double* x, double* y, size_t n) {
+  active_kernels()->sigmoid(x, y, n);
+}
+
+void vgelu(const double* x, double* y, double* t, size_t n) {
+  active_kernels()->gelu(x, y, t, n);
+}
+
+void tanh_backward(const double* y, const double* dy, double* dx, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    dx[i] += (1.0 - y[i] * y[i]) * dy[i];
+  }
+}
+
+void sigmoid_backward(
+    const double* y,
+    const double* dy,
+    double* dx,
+    size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    dx[i] += y[i] * (1.0 - y[i]) * dy[i];
+  }
+}
+
+void gelu_backward(
+    const double* x,
+    const double* t,
+    const double* dy,
+    double* dx,
+    size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    double factor = 0.5 * (1.0 + t[i]) +
+        0.5 * x[i] * (1.0 - t[i] * t[i]) * kGeluScale *
+            (1.0 + 3 * kGeluCoeff * x[i] * x[i]);
+    dx[i] += factor * dy[i];
+  }
+}
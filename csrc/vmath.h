@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+/// Vectorized math over contiguous buffers
+/// exp, tanh, sigmoid and gelu on `n` doubles at a time, with AVX-512 or
+/// AVX2 when the CPU has them (the same code, 8 / 4 / 2 lanes wide). Inputs
+/// and outputs may be the same buffer.
+///
+/// - exp: range reduced to r in [-ln2/2, ln2/2], then a degree 13 Taylor
+///   polynomial. Max relative error 3e-16 (about 1 ulp). Overflows to inf
+///   above ln(DBL_MAX); results below 2^-1021 (x < -708) flush to 0.
+/// - tanh: x + x^3 P(x^2) / Q(x^2) (Cephes) for |x| < 0.625, otherwise
+///   1 - 2 / (exp(2|x|) + 1). Max relative error 4e-16.
+/// - sigmoid: 1 / (1 + exp(-x)), max relative error 5e-16.
+/// - gelu (tanh approximation): 0.5 x (1 + tanh(u)), built on tanh above.
+/// NaN in gives NaN out.
+
+// kernels in use: "avx512", "avx2" or "generic"
+std::string vmath_kernel();
+
+// use given kernels (for tests & benchmarks). Returns false, and changes
+// nothing, if they are unknown or not supported by this CPU.
+bool set_vmath_kernel(const std::string& name);
+
+void vexp(const double* x, double* y, size_t n);
+void vtanh(const double* x, double* y, size_t n);
+void vsigmoid(const double* x, double* y, size_t n);
+
+// y = gelu(x). `t`, if not null, gets tanh(u) for gelu_backward, which then
+// has nothing transcendental left to compute.
+void vgelu(const double* x, double* y, double* t, size_t n);
+
+// dx += dy * f'(x), from what the forward computed
+void tanh_backward(const double* y, const double* dy, double* dx, size_t n);
+void sigmoid_backward(const double* y, const double* dy, double* dx, size_t n);
+void gelu_backward(
+    const double* x,
+    const double* t,
+    const double* dy,
+    double* dx,
+    size_t n);
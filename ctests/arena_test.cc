@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+#include "arena.h"
+#include "tensor.h"
+#include "value.h"
+
+TEST(ArenaTest, ResetRewindsWhenNodesAreGone) {
+  Arena& arena = Arena::current();
+  ASSERT_TRUE(arena.reset());
+
+  std::shared_ptr<Value> x = std::make_shared<Value>(2.0);
+  Value* first = nullptr;
+  {
+    std::shared_ptr<Value> y = x->mul(x)->add(x);
+    first = y->prev()[0].get(); // x * x
+    EXPECT_EQ(arena.live(), 2);
+    EXPECT_FALSE(arena.reset()); // nodes still alive
+  }
+  EXPECT_EQ(arena.live(), 0);
+  EXPECT_TRUE(arena.reset());
+
+  // the next step reuses the same memory
+  std::shared_ptr<Value> z = x->mul(x);
+  EXPECT_EQ(z.get(), first);
+  EXPECT_DOUBLE_EQ(z->data, 4.0);
+}
+
+TEST(ArenaTest, LeavesAreNotInTheArena) {
+  Arena& arena = Arena::current();
+  size_t live = arena.live();
+  std::shared_ptr<Value> v = std::make_shared<Value>(1.0);
+  std::shared_ptr<Tensor> t = std::make_shared<Tensor>(std::vector<int>{2});
+  EXPECT_EQ(arena.live(), live);
+
+  std::shared_ptr<Tensor> out = t->relu();
+  EXPECT_EQ(arena.live(), live + 1);
+}
+
+TEST(ArenaTest, PinnedNodeOnlyPinsItsChunk) {
+  Arena& arena = Arena::current();
+  std::shared_ptr<Value> x = std::make_shared<Value>(1.0);
+
+  // a node kept across steps, like a logged loss
+  std::shared_ptr<Value> kept = x->add(x);
+  size_t chunks = 0;
+
+  // every step builds a graph spanning several chunks, then drops it
+  for (int step = 0; step < 20; step++) {
+    std::shared_ptr<Value> out = x;
+    for (int i = 0; i < 10000; i++) {
+      out = out->add(x);
+    }
+    out->backward();
+    EXPECT_DOUBLE_EQ(x->grad, double(10001 + step * 10001));
+    out.reset();
+    arena.reset();
+
+    // filled chunks went back to the free list and are reused (the first
+    // step shared its first chunk with `kept`, so it needed one less)
+    if (step == 1) {
+      chunks = arena.chunk_count();
+    }
+    if (step >= 1) {
+      EXPECT_EQ(arena.chunk_count(), chunks);
+    }
+  }
+  EXPECT_DOUBLE_EQ(kept->data, 2.0);
+}
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "buffer_cache.h"
+#include "tensor.h"
+
+TEST(BufferCacheTest, ReusesBuffersOfASize) {
+  BufferCache& cache = BufferCache::global();
+  cache.empty();
+  std::shared_ptr<Tensor> x =
+      std::make_shared<Tensor>(std::vector<int>{100, 100});
+  cache.reset_stats();
+
+  const double* buffer = nullptr;
+  for (int step = 0; step < 3; step++) {
+    std::shared_ptr<Tensor> y = x->relu();
+    if (step == 0) {
+      buffer = y->data.data();
+    }
+    // same class, same buffer. relu writes every element over what the
+    // last step left.
+    EXPECT_EQ(y->data.data(), buffer);
+    EXPECT_EQ(y->data[42], 0.0);
+    y->data[42] = 1.0;
+  }
+  BufferCache::Stats stats = cache.stats();
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.hits, 2u);
+  // 10000 elements, in the class of 5 * 2^11
+  EXPECT_EQ(stats.buffers_cached, 1u);
+  EXPECT_EQ(stats.bytes_cached, 5 * (1u << 11) * sizeof(double));
+
+  // a smaller size of the class, and a view keeping a buffer in use
+  std::shared_ptr<Tensor> z =
+      std::make_shared<Tensor>(std::vector<int>{9000});
+  EXPECT_EQ(z->data.data(), buffer);
+  EXPECT_EQ(z->data.size(), 9000u);
+  std::shared_ptr<Tensor> v = z->reshape({90, 100});
+  z.reset();
+  EXPECT_EQ(cache.stats().buffers_cached, 0u);
+  v.reset();
+  EXPECT_EQ(cache.stats().buffers_cached, 1u);
+
+  cache.empty();
+  EXPECT_EQ(cache.stats().bytes_cached, 0u);
+}
+
+TEST(BufferCacheTest, LimitCapsTheCache) {
+  BufferCache& cache = BufferCache::global();
+  cache.empty();
+  cache.set_limit(1000 * sizeof(double));
+  {
+    std::shared_ptr<Tensor> big =
+        std::make_shared<Tensor>(std::vector<int>{5000});
+    std::shared_ptr<Tensor> small =
+        std::make_shared<Tensor>(std::vector<int>{500});
+  }
+  // the small one fits, the big one went back to malloc
+  EXPECT_EQ(cache.stats().buffers_cached, 1u);
+  EXPECT_EQ(cache.stats().bytes_cached, 512 * sizeof(double));
+
+  cache.set_limit(0);
+  EXPECT_EQ(cache.stats().buffers_cached, 0u);
+  cache.set_limit(BufferCache::kDefaultLimit);
+}
+
+TEST(BufferCacheTest, ClassesWasteAtMostAQuarter) {
+  BufferCache& cache = BufferCache::global();
+  cache.set_limit(0);
+  for (size_t n = 1; n < 200000; n += 37) {
+    size_t size = cache.acquire(n)->size();
+    EXPECT_GE(size, n);
+    if (n <= 1024) {
+      // 512 bytes at a time
+      EXPECT_EQ(size % 64, 0u);
+      EXPECT_LT(size - n, 64u);
+    } else {
+      EXPECT_LE(size, n + n / 4);
+    }
+  }
+  cache.set_limit(BufferCache::kDefaultLimit);
+}
+
+TEST(BufferCacheTest, NewTensorsAreZeroed) {
+  BufferCache& cache = BufferCache::global();
+  cache.empty();
+  const double* buffer = nullptr;
+  {
+    std::shared_ptr<Tensor> x =
+        std::make_shared<Tensor>(std::vector<int>{30, 30});
+    buffer = x->data.data();
+    std::fill(x->data.begin(), x->data.end(), 1.0);
+  }
+  // the buffer x left, not as x left it
+  std::shared_ptr<Tensor> y =
+      std::make_shared<Tensor>(std::vector<int>{900});
+  EXPECT_EQ(y->data.data(), buffer);
+  for (size_t i = 0; i < y->data.size(); i++) {
+    EXPECT_EQ(y->data[i], 0.0);
+  }
+}
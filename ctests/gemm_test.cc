@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "gemm.h"
+
+// element (i, j) of op(X), X stored row-major with row stride `ld`
+static double at(const std::vector<double>& x, bool trans, int ld, int i,
+                 int j) {
+  return trans ? x[j * ld + i] : x[i * ld + j];
+}
+
+TEST(GemmTest, MatchesNaiveForEveryKernel) {
+  std::string original = gemm_kernel();
+  // small, odd (edge tiles) and larger than a cache block in every dim
+  std::vector<std::vector<int>> sizes = {
+      {1, 1, 1}, {3, 5, 7}, {17, 33, 9}, {101, 67, 300}, {130, 2100, 3}};
+
+  for (std::string kernel : {"generic", "avx2", "avx512"}) {
+    if (!set_gemm_kernel(kernel)) {
+      continue; // not supported on this CPU
+    }
+    EXPECT_EQ(gemm_kernel(), kernel);
+
+    for (auto& mnk : sizes) {
+      int m = mnk[0], n = mnk[1], k = mnk[2];
+      for (int t = 0; t < 4; t++) {
+        bool trans_a = t & 1;
+        bool trans_b = t & 2;
+        int lda = trans_a ? m : k;
+        int ldb = trans_b ? k : n;
+
+        std::vector<double> a(m * k), b(k * n), c(m * n, 1.0);
+        for (size_t i = 0; i < a.size(); i++) {
+          a[i] = double(i % 13) - 6.0;
+        }
+        for (size_t i = 0; i < b.size(); i++) {
+          b[i] = double(i % 7) * 0.5 - 1.0;
+        }
+        gemm(trans_a, trans_b, m, n, k, a.data(), lda, b.data(), ldb,
+             c.data(), n);
+
+        for (int i = 0; i < m; i++) {
+          for (int j = 0; j < n; j++) {
+            double expected = 1.0; // accumulates into C
+            for (int p = 0; p < k; p++) {
+              expected += at(a, trans_a, lda, i, p) * at(b, trans_b, ldb, p, j);
+            }
+            ASSERT_NEAR(c[i * n + j], expected, 1e-9)
+                << kernel << " m=" << m << " n=" << n << " k=" << k
+                << " trans_a=" << trans_a << " trans_b=" << trans_b;
+          }
+        }
+      }
+    }
+  }
+
+  set_gemm_kernel(original);
+}
+
+TEST(GemmTest, UnknownKernel) {
+  std::string original = gemm_kernel();
+  EXPECT_FALSE(set_gemm_kernel("sse9"));
+  EXPECT_EQ(gemm_kernel(), original);
+}
@@ -1,9 +1,17 @@
 #include <gtest/gtest.h>
+#include <cmath>
 #include <memory>
 #include <vector>
+#include "capture.h"
+#include "grad_mode.h"
+#include "layers/convolutional_layer.h"
+#include "layers/flatten.h"
 #include "layers/linear_layer.h"
 #include "layers/non_linear_layer.h"
+#include "loss.h"
 #include "neural_network.h"
+#include "optimizer.h"
+#include "thread_pool.h"
 
 // it'll fail due to seed on linux generate different values
 
@@ -128,3 +136,383 @@
 //     idx++;
 //   }
 // }
+
+// numerical gradient check of a whole model, parameters are nudged in place
+TEST(ModelTest, ConvModelGradientCheck) {
+  std::shared_ptr<Model> model = std::make_shared<Model>(
+      std::vector<std::shared_ptr<Layer>>{
+          std::make_shared<Conv2D>(2, 3, 3, 1, 1),
+          std::make_shared<ReLu>(),
+          std::make_shared<MaxPooling2D>(2, 2),
+          std::make_shared<Flatten>(),
+          std::make_shared<LinearLayer>(12, 2, 7, "XAVIER", "NORMAL"),
+          std::make_shared<Tanh>(),
+      },
+      false);
+
+  std::shared_ptr<Tensor> inp =
+      std::make_shared<Tensor>(std::vector<int>{2, 4, 4});
+  for (int i = 0; i <= inp->maxIdx; i++) {
+    inp->data[i] = std::sin(0.7 * i);
+  }
+  std::shared_ptr<Tensor> target = std::make_shared<Tensor>(std::vector<int>{2});
+  target->data = {0.3, -0.2};
+
+  auto loss_fn = [&]() { return mean_squared_error(model->call(inp), target); };
+
+  loss_fn()->backward();
+
+  double eps = 1e-6;
+  double tolerance = 1e-5;
+  for (auto& p : model->parameters()) {
+    for (size_t i = 0; i < p->data.size(); i++) {
+      double original = p->data[i];
+      p->data[i] = original + eps;
+      double plus = loss_fn()->data;
+      p->data[i] = original - eps;
+      double minus = loss_fn()->data;
+      p->data[i] = original;
+
+      EXPECT_NEAR(p->grad[i], (plus - minus) / (2 * eps), tolerance);
+    }
+  }
+}
+
+TEST(ModelTest, LossBackwardFreesActivations) {
+  Conv2D conv(2, 3, 3, 1, 1);
+  ReLu relu;
+  Flatten flatten;
+  LinearLayer linear(48, 2, 7, "XAVIER", "NORMAL");
+  std::shared_ptr<Tensor> inp =
+      std::make_shared<Tensor>(std::vector<int>{2, 4, 4});
+  for (int i = 0; i <= inp->maxIdx; i++) {
+    inp->data[i] = std::sin(0.7 * i);
+  }
+  std::shared_ptr<Tensor> target = std::make_shared<Tensor>(std::vector<int>{2});
+
+  // the conv activation is only held by the graph (and `activation`)
+  std::weak_ptr<Tensor> activation;
+  auto forward = [&]() {
+    std::shared_ptr<Tensor> a = conv.call(inp, false);
+    activation = a;
+    std::shared_ptr<Tensor> out =
+        linear.call(flatten.call(relu.call(a, false), false), false);
+    return mean_squared_error(out, target);
+  };
+
+  // the loss is still alive, the activation is freed by backward itself
+  std::shared_ptr<Value> loss = forward();
+  EXPECT_FALSE(activation.expired());
+  loss->backward();
+  EXPECT_TRUE(activation.expired());
+  EXPECT_FALSE(conv.parameters()[0]->grad.empty());
+
+  // unless the graph is retained
+  loss = forward();
+  loss->backward(true);
+  EXPECT_FALSE(activation.expired());
+  loss.reset();
+  EXPECT_TRUE(activation.expired());
+}
+
+TEST(ModelTest, SGDStepTest) {
+  std::shared_ptr<Model> model = std::make_shared<Model>(
+      std::vector<std::shared_ptr<Layer>>{
+          std::make_shared<LinearLayer>(2, 1, 42),
+      },
+      false);
+  SGD opt(model, 0.1);
+
+  std::shared_ptr<Tensor> inp = std::make_shared<Tensor>(std::vector<int>{2});
+  inp->data = {0.5, 0.3};
+  std::shared_ptr<Tensor> target = std::make_shared<Tensor>(std::vector<int>{1});
+  target->data = {1.0};
+
+  double first_loss = mean_squared_error(model->call(inp), target)->data;
+  for (int i = 0; i < 20; i++) {
+    opt.zero_grad();
+    mean_squared_error(model->call(inp), target)->backward();
+    opt.step();
+  }
+  double last_loss = mean_squared_error(model->call(inp), target)->data;
+
+  EXPECT_LT(last_loss, first_loss);
+  EXPECT_LT(last_loss, 1e-3);
+}
+
+TEST(ModelTest, NoGradInference) {
+  std::shared_ptr<Model> model = std::make_shared<Model>(
+      std::vector<std::shared_ptr<Layer>>{
+          std::make_shared<Conv2D>(1, 2, 3, 1, 1),
+          std::make_shared<MaxPooling2D>(2, 2),
+          std::make_shared<Flatten>(),
+          std::make_shared<LinearLayer>(8, 3, 7),
+          std::make_shared<SoftMax>(),
+      },
+      false);
+
+  std::shared_ptr<Tensor> inp =
+      std::make_shared<Tensor>(std::vector<int>{1, 4, 4});
+  for (int i = 0; i <= inp->maxIdx; i++) {
+    inp->data[i] = std::cos(0.3 * i);
+  }
+
+  std::shared_ptr<Tensor> out = model->call(inp);
+  EXPECT_FALSE(out->_prev.empty());
+
+  std::shared_ptr<Tensor> inference_out;
+  {
+    NoGradGuard no_grad;
+    inference_out = model->call(inp);
+  }
+  EXPECT_EQ(inference_out->data, out->data);
+  EXPECT_TRUE(inference_out->_prev.empty());
+  EXPECT_TRUE(inference_out->is_leaf());
+}
+
+TEST(ModelTest, CapturedStepMatchesEager) {
+  auto make_model = []() {
+    return std::make_shared<Model>(
+        std::vector<std::shared_ptr<Layer>>{
+            std::make_shared<LinearLayer>(3, 5, 11),
+            std::make_shared<Tanh>(),
+            std::make_shared<LinearLayer>(5, 2, 12),
+        },
+        false);
+  };
+  std::shared_ptr<Model> eager_model = make_model();
+  std::shared_ptr<Model> captured_model = make_model();
+  SGD eager_opt(eager_model, 0.05);
+  SGD captured_opt(captured_model, 0.05);
+
+  auto input_at = [](int step) {
+    return std::vector<double>{
+        std::sin(step * 0.3), std::cos(step * 0.2), 0.1 * step};
+  };
+  auto target_at = [](int step) {
+    return std::vector<double>{0.5, -0.25 + 0.01 * step};
+  };
+
+  std::shared_ptr<Tensor> inp = std::make_shared<Tensor>(std::vector<int>{3});
+  std::shared_ptr<Tensor> target = std::make_shared<Tensor>(std::vector<int>{2});
+  inp->data = input_at(0);
+  target->data = target_at(0);
+
+  captured_opt.zero_grad();
+  CapturedStep captured(captured_model, inp, target, mean_squared_error);
+  double captured_loss = captured.loss();
+  size_t graph_size = captured.size();
+
+  for (int step = 0; step < 10; step++) {
+    if (step > 0) {
+      captured_opt.zero_grad();
+      captured_loss = captured.replay(input_at(step), target_at(step));
+    }
+    captured_opt.step();
+
+    std::shared_ptr<Tensor> eager_inp =
+        std::make_shared<Tensor>(std::vector<int>{3});
+    std::shared_ptr<Tensor> eager_target =
+        std::make_shared<Tensor>(std::vector<int>{2});
+    eager_inp->data = input_at(step);
+    eager_target->data = target_at(step);
+    eager_opt.zero_grad();
+    std::shared_ptr<Value> eager_loss =
+        mean_squared_error(eager_model->call(eager_inp), eager_target);
+    eager_loss->backward();
+    eager_opt.step();
+
+    EXPECT_DOUBLE_EQ(captured_loss, eager_loss->data);
+  }
+
+  std::vector<std::shared_ptr<Tensor>> eager_params = eager_model->parameters();
+  std::vector<std::shared_ptr<Tensor>> captured_params =
+      captured_model->parameters();
+  for (size_t p = 0; p < eager_params.size(); p++) {
+    for (size_t i = 0; i < eager_params[p]->data.size(); i++) {
+      EXPECT_DOUBLE_EQ(captured_params[p]->data[i], eager_params[p]->data[i]);
+    }
+  }
+  EXPECT_EQ(captured.size(), graph_size); // the graph is not rebuilt
+
+  EXPECT_THROW(captured.replay({1.0}, target_at(0)), std::runtime_error);
+}
+
+TEST(ModelTest, CapturedStepReplaysLayersWithoutParameters) {
+  // Tanh first: its output doesn't require grad, but replay still has to
+  // recompute it from the new input
+  auto make_model = []() {
+    return std::make_shared<Model>(
+        std::vector<std::shared_ptr<Layer>>{
+            std::make_shared<Tanh>(),
+            std::make_shared<LinearLayer>(3, 2, 13),
+        },
+        false);
+  };
+  std::shared_ptr<Model> eager_model = make_model();
+  std::shared_ptr<Model> captured_model = make_model();
+
+  std::shared_ptr<Tensor> inp = std::make_shared<Tensor>(std::vector<int>{3});
+  std::shared_ptr<Tensor> target = std::make_shared<Tensor>(std::vector<int>{2});
+  inp->data = std::vector<double>{0.1, 0.2, 0.3};
+  target->data = std::vector<double>{0.5, -0.5};
+  CapturedStep captured(captured_model, inp, target, mean_squared_error);
+  EXPECT_FALSE(captured.output()->_prev.empty());
+
+  std::vector<double> new_input = {2.0, -1.5, 0.7};
+  std::vector<double> new_target = {-1.0, 1.0};
+  captured_model->zero_grad();
+  double captured_loss = captured.replay(new_input, new_target);
+
+  std::shared_ptr<Tensor> eager_inp =
+      std::make_shared<Tensor>(std::vector<int>{3});
+  std::shared_ptr<Tensor> eager_target =
+      std::make_shared<Tensor>(std::vector<int>{2});
+  eager_inp->data = new_input;
+  eager_target->data = new_target;
+  std::shared_ptr<Value> eager_loss =
+      mean_squared_error(eager_model->call(eager_inp), eager_target);
+  eager_loss->backward();
+
+  EXPECT_DOUBLE_EQ(captured_loss, eager_loss->data);
+  std::vector<std::shared_ptr<Tensor>> eager_params = eager_model->parameters();
+  std::vector<std::shared_ptr<Tensor>> captured_params =
+      captured_model->parameters();
+  for (size_t p = 0; p < eager_params.size(); p++) {
+    for (size_t i = 0; i < eager_params[p]->grad.size(); i++) {
+      EXPECT_DOUBLE_EQ(captured_params[p]->grad[i], eager_params[p]->grad[i]);
+    }
+  }
+  EXPECT_TRUE(inp->grad.empty()); // the input still gets no gradient
+}
+
+TEST(ModelTest, CheckpointedGradientsMatch) {
+  auto make_model = [](int checkpoint_every) {
+    std::shared_ptr<Model> model = std::make_shared<Model>(
+        std::vector<std::shared_ptr<Layer>>{
+            std::make_shared<Conv2D>(2, 3, 3, 1, 1),
+            std::make_shared<ReLu>(),
+            std::make_shared<Conv2D>(3, 2, 3, 1, 1),
+            std::make_shared<MaxPooling2D>(2, 2),
+            std::make_shared<Flatten>(),
+            std::make_shared<LinearLayer>(8, 2, 7, "XAVIER", "NORMAL"),
+        },
+        false);
+    model->checkpoint_every = checkpoint_every;
+    return model;
+  };
+  std::shared_ptr<Model> plain = make_model(0);
+  std::shared_ptr<Model> checkpointed = make_model(2);
+
+  std::shared_ptr<Tensor> inp =
+      std::make_shared<Tensor>(std::vector<int>{2, 4, 4});
+  for (int i = 0; i <= inp->maxIdx; i++) {
+    inp->data[i] = std::sin(0.7 * i);
+  }
+  std::shared_ptr<Tensor> target = std::make_shared<Tensor>(std::vector<int>{2});
+  target->data = {0.3, -0.2};
+
+  std::shared_ptr<Tensor> out = checkpointed->call(inp);
+  // only the output of each of the 3 segments is part of the graph
+  EXPECT_EQ(out->_op, 'K');
+  EXPECT_EQ(out->_prev[0]->_op, 'K');
+  EXPECT_EQ(out->_prev[0]->_prev[0]->_op, 'K');
+  EXPECT_EQ(out->_prev[0]->_prev[0]->_prev[0], inp);
+
+  std::shared_ptr<Value> loss = mean_squared_error(out, target);
+  std::shared_ptr<Value> plain_loss =
+      mean_squared_error(plain->call(inp), target);
+  EXPECT_DOUBLE_EQ(loss->data, plain_loss->data);
+
+  loss->backward();
+  plain_loss->backward();
+
+  std::vector<std::shared_ptr<Tensor>> plain_params = plain->parameters();
+  std::vector<std::shared_ptr<Tensor>> params = checkpointed->parameters();
+  for (size_t p = 0; p < params.size(); p++) {
+    for (size_t i = 0; i < params[p]->data.size(); i++) {
+      EXPECT_NEAR(params[p]->grad[i], plain_params[p]->grad[i], 1e-12);
+    }
+  }
+
+  // two checkpointed branches accumulating into the same input, backward
+  // on the thread pool
+  auto input_grad = [&](std::shared_ptr<Model> model) {
+    std::shared_ptr<Tensor> x = std::make_shared<Tensor>(inp->shape);
+    x->data = inp->data;
+    x->requires_grad = true;
+    model->call(x)->add(model->call(x))->backward();
+    return x->grad.to_vector();
+  };
+  size_t threads = ThreadPool::global().size();
+  ThreadPool::set_global_threads(4);
+  std::vector<double> grad = input_grad(checkpointed);
+  ThreadPool::set_global_threads(threads);
+  std::vector<double> plain_grad = input_grad(plain);
+  for (size_t i = 0; i < grad.size(); i++) {
+    EXPECT_NEAR(grad[i], plain_grad[i], 1e-12);
+  }
+}
+
+TEST(ModelTest, IntraOpThreadsMatchSingleThread) {
+  // big enough for conv, pooling, activations and matmul to be split
+  auto run = [](int threads) {
+    set_num_threads(threads);
+    std::shared_ptr<Model> model = std::make_shared<Model>(
+        std::vector<std::shared_ptr<Layer>>{
+            std::make_shared<Conv2D>(3, 8, 3, 1, 1, 5, "HE", "NORMAL"),
+            std::make_shared<GeLu>(),
+            std::make_shared<MaxPooling2D>(2, 2),
+            std::make_shared<Flatten>(),
+            std::make_shared<LinearLayer>(8 * 24 * 24, 16, 6),
+            std::make_shared<Sigmoid>(),
+        },
+        false);
+    std::shared_ptr<Tensor> inp =
+        std::make_shared<Tensor>(std::vector<int>{3, 48, 48});
+    for (int i = 0; i <= inp->maxIdx; i++) {
+      inp->data[i] = std::sin(0.01 * i);
+    }
+    std::shared_ptr<Tensor> target =
+        std::make_shared<Tensor>(std::vector<int>{16});
+    mean_squared_error(model->call(inp), target)->backward();
+
+    std::vector<double> grads;
+    for (auto& p : model->parameters()) {
+      grads.insert(grads.end(), p->grad.begin(), p->grad.end());
+    }
+    return grads;
+  };
+
+  std::vector<double> serial = run(1);
+  std::vector<double> parallel = run(4);
+  set_num_threads(0);
+
+  ASSERT_EQ(serial.size(), parallel.size());
+  for (size_t i = 0; i < serial.size(); i++) {
+    ASSERT_NEAR(serial[i], parallel[i], 1e-12) << i;
+  }
+}
+
+TEST(ModelTest, ElementwiseLayersAreFused) {
+  Model model(
+      std::vector<std::shared_ptr<Layer>>{
+          std::make_shared<LinearLayer>(3, 4, 1),
+          std::make_shared<ReLu>(),
+          std::make_shared<Tanh>(),
+          std::make_shared<LinearLayer>(4, 2, 2),
+          std::make_shared<Sigmoid>(),
+      },
+      false);
+  std::shared_ptr<Tensor> inp =
+      std::make_shared<Tensor>(std::vector<int>{2, 3});
+  inp->data = {0.5, -1.0, 2.0, 1.5, 0.0, -0.5};
+
+  // each bias add runs with the activations after it, in one node
+  std::shared_ptr<Tensor> out = model.call(inp);
+  EXPECT_EQ(out->_op, 'F');
+  EXPECT_EQ(out->_prev[0]->_op, '@');
+  EXPECT_EQ(out->_prev[0]->_prev[0]->_op, 'F');
+  EXPECT_EQ(out->_prev[0]->_prev[0]->_prev[0]->_op, '@');
+  EXPECT_EQ(out->_prev[0]->_prev[0]->_prev[0]->_prev[0], inp);
+}
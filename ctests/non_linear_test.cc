@@ -119,6 +119,7 @@ TEST(NonLinearValue, GeluTest) {
 TEST(FunctionalNonLinear, ReluTest) {
   std::shared_ptr<Tensor> inputs =
       std::make_shared<Tensor>(std::vector<int>{3});
+  inputs->requires_grad = true;
   inputs->set(0, std::make_shared<Value>(-1.0));
   inputs->set(1, std::make_shared<Value>(0.0));
   inputs->set(2, std::make_shared<Value>(2.0));
@@ -129,8 +130,8 @@ TEST(FunctionalNonLinear, ReluTest) {
   EXPECT_DOUBLE_EQ(outputs->get(1)->data, 0.0);
   EXPECT_DOUBLE_EQ(outputs->get(2)->data, 2.0);
 
-  // Backward pass
-  outputs->get(0)->backward();
+  // Backward pass, twice through the same graph: the first one keeps it
+  outputs->get(0)->backward(true);
   EXPECT_DOUBLE_EQ(inputs->get(0)->grad, 0.0);
   outputs->get(2)->backward();
   EXPECT_DOUBLE_EQ(inputs->get(2)->grad, 1.0);
@@ -139,6 +140,7 @@ TEST(FunctionalNonLinear, ReluTest) {
 TEST(FunctionalNonLinear, TanhTest) {
   std::shared_ptr<Tensor> inputs =
       std::make_shared<Tensor>(std::vector<int>{3});
+  inputs->requires_grad = true;
   inputs->set(0, std::make_shared<Value>(-1.0));
   inputs->set(1, std::make_shared<Value>(0.0));
   inputs->set(2, std::make_shared<Value>(1.0));
@@ -157,6 +159,7 @@ TEST(FunctionalNonLinear, TanhTest) {
 TEST(FunctionalNonLinear, SigmoidTest) {
   std::shared_ptr<Tensor> inputs =
       std::make_shared<Tensor>(std::vector<int>{3});
+  inputs->requires_grad = true;
   inputs->set(0, std::make_shared<Value>(-1.0));
   inputs->set(1, std::make_shared<Value>(0.0));
   inputs->set(2, std::make_shared<Value>(1.0));
@@ -176,6 +179,7 @@ TEST(FunctionalNonLinear, LeakyReluTest) {
   double alpha = 0.1;
   std::shared_ptr<Tensor> inputs =
       std::make_shared<Tensor>(std::vector<int>{3});
+  inputs->requires_grad = true;
   inputs->set(0, std::make_shared<Value>(-1.0));
   inputs->set(1, std::make_shared<Value>(0.0));
   inputs->set(2, std::make_shared<Value>(2.0));
@@ -195,6 +199,7 @@ TEST(FunctionalNonLinear, LeakyReluTest) {
 TEST(FunctionalNonLinear, SoftmaxTest) {
   std::shared_ptr<Tensor> inputs =
       std::make_shared<Tensor>(std::vector<int>{3});
+  inputs->requires_grad = true;
   inputs->set(0, std::make_shared<Value>(1.0));
   inputs->set(1, std::make_shared<Value>(2.0));
   inputs->set(2, std::make_shared<Value>(3.0));
@@ -1,7 +1,11 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <vector>
+#include "fusion.h"
 #include "tensor.h"
+#include "thread_pool.h"
 
 // ========= TESTs =========
 TEST(TensorTest, IntializeAndCheckGetSet) {
@@ -132,6 +136,67 @@ TEST_F(TensorFixtureTest, AddTest) {
   EXPECT_DOUBLE_EQ(t_sum->get(5)->data, double(16));
 }
 
+TEST_F(TensorFixtureTest, BroadcastingOps) {
+  // per-column bias: (2, 3) + (3)
+  t3 = std::make_shared<Tensor>(std::vector<int>{3});
+  t3->data = {100, 200, 300};
+  t1->requires_grad = true;
+  t3->requires_grad = true;
+  std::shared_ptr<Tensor> biased = t1->add(t3);
+  EXPECT_EQ(biased->shape, std::vector<int>({2, 3}));
+  EXPECT_EQ(biased->data, std::vector<double>({101, 202, 303, 104, 205, 306}));
+
+  // per-row scale: (2, 3) * (2, 1)
+  std::shared_ptr<Tensor> scale =
+      std::make_shared<Tensor>(std::vector<int>{2, 1});
+  scale->data = {2, -1};
+  scale->requires_grad = true;
+  std::shared_ptr<Tensor> out = biased->mul(scale);
+  EXPECT_EQ(out->data, std::vector<double>({202, 404, 606, -104, -205, -306}));
+
+  out->backward();
+  // summed over the broadcast dims
+  EXPECT_EQ(t3->grad, std::vector<double>({2 - 1, 2 - 1, 2 - 1}));
+  EXPECT_EQ(
+      scale->grad, std::vector<double>({101 + 202 + 303, 104 + 205 + 306}));
+  EXPECT_EQ(t1->grad, std::vector<double>({2, 2, 2, -1, -1, -1}));
+
+  // outer "product" through sub, div and maximum: (2, 1) op (1, 3)
+  std::shared_ptr<Tensor> row = t3->unsqueeze(0);
+  EXPECT_EQ(scale->sub(row)->shape, std::vector<int>({2, 3}));
+  EXPECT_DOUBLE_EQ(scale->sub(row)->get({1, 2})->data, -301.0);
+  EXPECT_DOUBLE_EQ(row->div(scale)->get({1, 0})->data, -100.0);
+  EXPECT_EQ(
+      t1->maximum(std::make_shared<Tensor>(std::vector<int>{1}))->data,
+      std::vector<double>({1, 2, 3, 4, 5, 6}));
+
+  EXPECT_THROW(t1->add(t2), std::runtime_error); // (2, 3) vs (3, 2)
+}
+
+TEST_F(TensorFixtureTest, ScalarValueOperands) {
+  // a leaf Value: its gradient is accumulated
+  t1->requires_grad = true;
+  std::shared_ptr<Value> d = std::make_shared<Value>(2.0);
+  t1->div(d)->backward();
+  EXPECT_DOUBLE_EQ(d->grad, -21.0 / 4.0); // -sum(x) / d^2
+
+  // a Value with a graph behind it: the gradient couldn't reach that graph,
+  // so it's refused rather than dropped
+  std::shared_ptr<Value> computed = d->mul(std::make_shared<Value>(3.0));
+  EXPECT_THROW(t1->div(computed), std::runtime_error);
+  EXPECT_THROW(t1->set(0, computed), std::runtime_error);
+  EXPECT_THROW(t2->set(0, t1->get(1)), std::runtime_error);
+
+  // fine once detached, or when no graph is recorded
+  std::shared_ptr<Value> detached = std::make_shared<Value>(computed->data);
+  EXPECT_DOUBLE_EQ(t1->div(detached)->data[5], 1.0);
+  t2->set(0, detached);
+  EXPECT_DOUBLE_EQ(t2->data[0], 6.0);
+  NoGradGuard no_grad;
+  t2->set(1, t1->get(1));
+  EXPECT_DOUBLE_EQ(t2->data[1], 2.0);
+}
+
 TEST_F(TensorFixtureTest, MatMulTestTwoDim) {
   // t4: [[140, 146], [320, 335]]
   std::shared_ptr<Tensor> t4 = t1->matmul(t2);
@@ -164,3 +229,556 @@ TEST_F(TensorFixtureTest, MatMulTestOneDim1) {
   EXPECT_DOUBLE_EQ(t4->get(1)->data, double(1200));
   EXPECT_DOUBLE_EQ(t4->get(2)->data, double(1500));
 }
+
+TEST_F(TensorFixtureTest, MatMulBackwardTest) {
+  t1->requires_grad = true;
+  t2->requires_grad = true;
+  std::shared_ptr<Tensor> t4 = t1->matmul(t2);
+  t4->backward();
+
+  // dA = ones(2, 2) . B^T  => row sums of t2
+  std::vector<double> expected_t1_grad = {21, 41, 61, 21, 41, 61};
+  // dB = A^T . ones(2, 2)  => column sums of t1
+  std::vector<double> expected_t2_grad = {5, 5, 7, 7, 9, 9};
+
+  for (int i = 0; i < 6; i++) {
+    EXPECT_DOUBLE_EQ(t1->grad[i], expected_t1_grad[i]);
+    EXPECT_DOUBLE_EQ(t2->grad[i], expected_t2_grad[i]);
+  }
+}
+
+TEST_F(TensorFixtureTest, BatchedMatMul) {
+  // batches: [t1, 2 * t1] and [t2, 2 * t2]
+  std::shared_ptr<Tensor> a =
+      std::make_shared<Tensor>(std::vector<int>{2, 2, 3});
+  a->data = {1, 2, 3, 4, 5, 6, 2, 4, 6, 8, 10, 12};
+  std::shared_ptr<Tensor> b =
+      std::make_shared<Tensor>(std::vector<int>{2, 3, 2});
+  b->data = {10, 11, 20, 21, 30, 31, 20, 22, 40, 42, 60, 62};
+  a->requires_grad = true;
+  t2->requires_grad = true;
+
+  // (2, 2, 3) @ (3, 2): t2 is shared by both batches
+  std::shared_ptr<Tensor> out = a->matmul(t2);
+  EXPECT_EQ(out->shape, std::vector<int>({2, 2, 2}));
+  EXPECT_EQ(
+      out->data,
+      std::vector<double>({140, 146, 320, 335, 280, 292, 640, 670}));
+  out->backward();
+  // dA: row sums of t2 in every batch, dB: column sums over both batches
+  EXPECT_EQ(
+      a->grad,
+      std::vector<double>({21, 41, 61, 21, 41, 61, 21, 41, 61, 21, 41, 61}));
+  EXPECT_EQ(t2->grad, std::vector<double>({15, 15, 21, 21, 27, 27}));
+
+  // (2, 3) @ (2, 3, 2): t1 is shared, its grad sums both batches
+  t1->requires_grad = true;
+  b->requires_grad = true;
+  out = t1->matmul(b);
+  EXPECT_EQ(
+      out->data,
+      std::vector<double>({140, 146, 320, 335, 280, 292, 640, 670}));
+  out->backward();
+  EXPECT_EQ(t1->grad, std::vector<double>({63, 123, 183, 63, 123, 183}));
+  EXPECT_EQ(
+      b->grad,
+      std::vector<double>({5, 5, 7, 7, 9, 9, 5, 5, 7, 7, 9, 9}));
+
+  // batch by batch
+  out = a->matmul(b);
+  EXPECT_EQ(
+      out->data,
+      std::vector<double>({140, 146, 320, 335, 560, 584, 1280, 1340}));
+
+  // a vector on the right is a column, and its dim is dropped
+  std::shared_ptr<Tensor> ones = std::make_shared<Tensor>(std::vector<int>{3});
+  ones->data = {1, 1, 1};
+  EXPECT_EQ(t1->matmul(ones)->shape, std::vector<int>({2}));
+  EXPECT_EQ(t1->matmul(ones)->data, std::vector<double>({6, 15}));
+  EXPECT_EQ(a->matmul(ones)->shape, std::vector<int>({2, 2}));
+
+  std::shared_ptr<Tensor> c =
+      std::make_shared<Tensor>(std::vector<int>{3, 3, 2});
+  EXPECT_THROW(a->matmul(c), std::runtime_error); // batch 2 vs 3
+  EXPECT_THROW(
+      a->reshape({1, 2, 2, 3})->matmul(t2), std::runtime_error); // 4-D
+}
+
+TEST_F(TensorFixtureTest, Reductions) {
+  t1->requires_grad = true;
+
+  // t1: [[1,2,3], [4,5,6]]
+  std::shared_ptr<Tensor> s = t1->sum({0});
+  EXPECT_EQ(s->shape, std::vector<int>({3}));
+  EXPECT_EQ(s->data, std::vector<double>({5, 7, 9}));
+  s = t1->sum({1}, true);
+  EXPECT_EQ(s->shape, std::vector<int>({2, 1}));
+  EXPECT_EQ(s->data, std::vector<double>({6, 15}));
+  s = t1->sum();
+  EXPECT_EQ(s->shape, std::vector<int>({1}));
+  EXPECT_EQ(s->data[0], 21);
+  s->backward();
+  EXPECT_EQ(t1->grad, std::vector<double>({1, 1, 1, 1, 1, 1}));
+
+  t1->zero_grad();
+  std::shared_ptr<Tensor> m = t1->mean({1});
+  EXPECT_EQ(m->data, std::vector<double>({2, 5}));
+  m->backward();
+  for (double g : t1->grad) {
+    EXPECT_DOUBLE_EQ(g, 1.0 / 3);
+  }
+
+  // a view reduces like its copy: columns of t1 as rows
+  std::shared_ptr<Tensor> mx = t1->transpose(0, 1)->max({1});
+  EXPECT_EQ(mx->data, std::vector<double>({4, 5, 6}));
+  EXPECT_EQ(t1->argmax({1})->data, std::vector<double>({2, 2}));
+  EXPECT_EQ(t1->argmax()->data, std::vector<double>({5}));
+  EXPECT_EQ(t1->argmax({0}, true)->shape, std::vector<int>({1, 3}));
+
+  t1->zero_grad();
+  mx = t1->max({0, 1});
+  EXPECT_EQ(mx->data[0], 6);
+  mx->backward();
+  EXPECT_EQ(t1->grad, std::vector<double>({0, 0, 0, 0, 0, 1}));
+
+  // var of [1,2,3] is 1 (unbiased), 2/3 (biased)
+  t1->zero_grad();
+  std::shared_ptr<Tensor> v = t1->var({1});
+  EXPECT_EQ(v->data, std::vector<double>({1, 1}));
+  EXPECT_DOUBLE_EQ(t1->var({1}, false, 0)->data[0], 2.0 / 3);
+  v->backward();
+  // 2 (x - mean) / 2
+  EXPECT_EQ(t1->grad, std::vector<double>({-1, 0, 1, -1, 0, 1}));
+
+  EXPECT_THROW(t1->sum({2}), std::invalid_argument);
+  EXPECT_THROW(t1->sum({0, 0}), std::invalid_argument);
+  EXPECT_THROW(t3->var({0}, false, 2), std::invalid_argument);
+}
+
+TEST_F(TensorFixtureTest, SoftmaxAlongDim) {
+  // t1: [[1,2,3], [4,5,6]]
+  t1->requires_grad = true;
+  for (int dim : {0, 1}) {
+    std::shared_ptr<Tensor> y = t1->softmax(dim);
+    std::shared_ptr<Tensor> ly = t1->log_softmax(dim);
+    EXPECT_EQ(y->shape, t1->shape);
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 3; j++) {
+        // the row (dim 1) or column (dim 0) of element (i, j)
+        double sum = 0.0;
+        for (int k = 0; k < (dim == 1 ? 3 : 2); k++) {
+          sum += std::exp(dim == 1 ? t1->data[i * 3 + k] : t1->data[k * 3 + j]);
+        }
+        double x = t1->data[i * 3 + j];
+        EXPECT_NEAR(y->data[i * 3 + j], std::exp(x) / sum, 1e-15);
+        EXPECT_NEAR(ly->data[i * 3 + j], x - std::log(sum), 1e-14);
+      }
+    }
+  }
+
+  // weighted sums of the outputs: dx = y * (w - S(w * y)) for softmax, and
+  // w - softmax * S(w) for log-softmax, S over the row
+  std::vector<double> w = {1, -2, 0.5, 3, 0, 1};
+  for (bool log : {false, true}) {
+    t1->zero_grad();
+    std::shared_ptr<Tensor> y = log ? t1->log_softmax(1) : t1->softmax(1);
+    Tensor::backward({y}, {w});
+    std::shared_ptr<Tensor> p = t1->softmax(1);
+    for (int i = 0; i < 2; i++) {
+      double s = 0.0;
+      for (int k = 0; k < 3; k++) {
+        s += log ? w[i * 3 + k] : w[i * 3 + k] * p->data[i * 3 + k];
+      }
+      for (int k = 0; k < 3; k++) {
+        int e = i * 3 + k;
+        double expected =
+            log ? w[e] - p->data[e] * s : p->data[e] * (w[e] - s);
+        EXPECT_NEAR(t1->grad[e], expected, 1e-14);
+      }
+    }
+  }
+
+  // a wide row, and the whole tensor as before
+  std::shared_ptr<Tensor> big =
+      std::make_shared<Tensor>(std::vector<int>{3, 5000});
+  for (size_t i = 0; i < big->numel(); i++) {
+    big->data[i] = std::sin(double(i)) * 50.0;
+  }
+  std::shared_ptr<Tensor> rows = big->softmax(1)->sum({1});
+  for (int i = 0; i < 3; i++) {
+    EXPECT_NEAR(rows->data[i], 1.0, 1e-13);
+  }
+  EXPECT_NEAR(big->softmax()->sum()->data[0], 1.0, 1e-13);
+  EXPECT_THROW(t1->softmax(2), std::invalid_argument);
+}
+
+TEST(TensorTest, PairwiseReductionsAreAccurate) {
+  // 0.1 isn't exact in binary: summed one by one, 10^6 of them are off by
+  // ~1e-6, pairwise by a few ulp
+  int n = 1000000;
+  std::shared_ptr<Tensor> x = std::make_shared<Tensor>(std::vector<int>{n});
+  std::fill(x->data.begin(), x->data.end(), 0.1);
+  x->data[n / 2 + 3] = 7.0;
+
+  set_num_threads(1);
+  std::shared_ptr<Tensor> serial = x->sum();
+  set_num_threads(4);
+  std::shared_ptr<Tensor> parallel = x->sum();
+  EXPECT_NEAR(serial->data[0], 100006.9, 1e-9);
+  // fixed blocks: the same result whatever the threads
+  EXPECT_EQ(serial->data[0], parallel->data[0]);
+
+  EXPECT_EQ(x->max()->data[0], 7.0);
+  EXPECT_EQ(x->argmax()->data[0], n / 2 + 3);
+
+  // a reduction over the leading dim, many outputs at once
+  std::shared_ptr<Tensor> y = x->reshape({1000, 1000});
+  std::shared_ptr<Tensor> cols = y->mean({0});
+  EXPECT_NEAR(cols->data[3], 0.1069, 1e-12);
+  EXPECT_NEAR(cols->data[4], 0.1, 1e-12);
+  set_num_threads(0);
+}
+
+TEST_F(TensorFixtureTest, ContiguousStorageTest) {
+  // set/get go through the flat buffer, in row-major order
+  std::vector<double> expected_data = {1, 2, 3, 4, 5, 6};
+  EXPECT_EQ(t1->data, expected_data);
+  EXPECT_TRUE(t1->grad.empty()); // grad is only allocated by backward
+
+  t1->set({1, 2}, std::make_shared<Value>(60));
+  EXPECT_DOUBLE_EQ(t1->data[5], 60.0);
+  EXPECT_DOUBLE_EQ(t1->get(5)->data, 60.0);
+}
+
+TEST_F(TensorFixtureTest, ViewsShareStorage) {
+  std::shared_ptr<Tensor> t = t1->transpose(0, 1);
+  EXPECT_EQ(t->shape, std::vector<int>({3, 2}));
+  EXPECT_FALSE(t->is_contiguous());
+  EXPECT_TRUE(t->data.shares_buffer(t1->data));
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 2; j++) {
+      EXPECT_DOUBLE_EQ(t->get({i, j})->data, t1->get({j, i})->data);
+    }
+  }
+
+  // writes to the base show through
+  t1->set({0, 2}, std::make_shared<Value>(30));
+  EXPECT_DOUBLE_EQ(t->get({2, 0})->data, 30.0);
+
+  // column 1 of t1, then as a row
+  std::shared_ptr<Tensor> col = t1->slice(1, 1, 2)->squeeze()->unsqueeze(0);
+  EXPECT_EQ(col->shape, std::vector<int>({1, 2}));
+  EXPECT_DOUBLE_EQ(col->get({0, 0})->data, 2.0);
+  EXPECT_DOUBLE_EQ(col->get({0, 1})->data, 5.0);
+
+  std::shared_ptr<Tensor> flat = t->flatten(); // has to copy
+  EXPECT_TRUE(flat->is_contiguous());
+  EXPECT_FALSE(flat->data.shares_buffer(t1->data));
+  EXPECT_EQ(flat->data, std::vector<double>({1, 4, 2, 5, 30, 6}));
+
+  std::shared_ptr<Tensor> r = t1->reshape({3, 2}); // doesn't
+  EXPECT_TRUE(r->data.shares_buffer(t1->data));
+  EXPECT_THROW(t1->reshape({4, 2}), std::runtime_error);
+  EXPECT_THROW(t1->permute({0, 0}), std::invalid_argument);
+  EXPECT_THROW(t1->slice(1, 2, 4), std::invalid_argument);
+}
+
+TEST(TensorTest, TensorOverExternalMemory) {
+  // memory owned elsewhere, as from_numpy passes it: a 2x3 array laid out
+  // column-major
+  std::vector<double> owned = {1, 4, 2, 5, 3, 6};
+  int released = 0;
+  std::shared_ptr<double> buffer(
+      owned.data(), [&released](double*) { released++; });
+  {
+    auto t = std::make_shared<Tensor>(
+        std::vector<int>({2, 3}),
+        std::vector<int>({1, 2}),
+        Storage::wrap(buffer, owned.size()));
+    buffer.reset();
+    EXPECT_FALSE(t->is_contiguous());
+    EXPECT_EQ(t->data.data(), owned.data()); // not copied
+    EXPECT_DOUBLE_EQ(t->at(0, 1), 2.0);
+    EXPECT_DOUBLE_EQ(t->at(1, 2), 6.0);
+
+    // writes go both ways
+    t->at(1, 0) = 40.0;
+    EXPECT_DOUBLE_EQ(owned[1], 40.0);
+    owned[4] = 30.0;
+    EXPECT_DOUBLE_EQ(t->at(0, 2), 30.0);
+
+    std::shared_ptr<Tensor> row = t->slice(0, 1, 2); // a view of it
+    std::shared_ptr<Tensor> sum = t->sum({0});
+    EXPECT_TRUE(row->data.shares_buffer(t->data));
+    EXPECT_EQ(sum->data, std::vector<double>({41, 7, 36}));
+
+    t.reset();
+    EXPECT_EQ(released, 0); // the view still holds it
+    EXPECT_DOUBLE_EQ(row->at(0, 0), 40.0);
+  }
+  EXPECT_EQ(released, 1);
+}
+
+TEST_F(TensorFixtureTest, ElementAccess) {
+  // t1: [[1,2,3], [4,5,6]]
+  EXPECT_EQ(t1->at(1, 2), 6);
+  t1->at(0, 1) = 20;
+  EXPECT_EQ(t1->get({0, 1})->data, 20);
+
+  // a view indexes by its own shape
+  std::shared_ptr<Tensor> t = t1->transpose(0, 1);
+  EXPECT_EQ(t->at(2, 1), 6);
+  EXPECT_EQ(t->offset_of(2, 0), 2);
+  EXPECT_THROW(t->at(3, 0), std::runtime_error);
+  EXPECT_THROW(t->at(0), std::runtime_error);
+
+  // row-major order of the view, and writes through it
+  std::vector<double> seen;
+  for (double& v : t->elements()) {
+    seen.push_back(v);
+    v += 1;
+  }
+  EXPECT_EQ(seen, std::vector<double>({1, 4, 20, 5, 3, 6}));
+  EXPECT_EQ(t1->data, std::vector<double>({2, 21, 4, 5, 6, 7}));
+
+  std::shared_ptr<Tensor> cols = t1->slice(1, 0, 3, 2);
+  const Tensor& c = *cols;
+  std::vector<int> last;
+  size_t count = 0;
+  for (auto it = c.elements().begin(); it != c.elements().end(); ++it) {
+    EXPECT_EQ(it.flat_index(), count++);
+    last = it.index();
+  }
+  EXPECT_EQ(count, 4u);
+  EXPECT_EQ(last, std::vector<int>({1, 1}));
+}
+
+TEST_F(TensorFixtureTest, ViewBackward) {
+  t1->requires_grad = true;
+  // rows 0 and 2 of t1^T: the columns 0 and 2 of t1. The slice is a view of
+  // a view that isn't contiguous.
+  std::shared_ptr<Tensor> cols = t1->transpose(0, 1)->slice(0, 0, 3, 2);
+  EXPECT_EQ(cols->shape, std::vector<int>({2, 2}));
+  EXPECT_DOUBLE_EQ(cols->get({1, 0})->data, 3.0);
+
+  // d/dt1 of sum(cols * [[1, 2], [3, 4]])
+  std::shared_ptr<Tensor> w = std::make_shared<Tensor>(std::vector<int>{2, 2});
+  w->data = {1, 2, 3, 4};
+  std::shared_ptr<Tensor> out = cols->reshape({1, 4})->matmul(
+      w->reshape({4, 1}));
+  out->backward();
+  // cols = [[t1_00, t1_10], [t1_02, t1_12]]
+  EXPECT_EQ(t1->grad, std::vector<double>({1, 0, 3, 2, 0, 4}));
+}
+
+TEST_F(TensorFixtureTest, ValueFromTensorBackwardTest) {
+  // scalar ops on values taken from a tensor backprop into the tensor graph
+  t1->requires_grad = true;
+  std::shared_ptr<Tensor> t_sum = t1->add(t1);
+  std::shared_ptr<Value> v = t_sum->get(0)->mul(t_sum->get(5));
+  v->backward();
+
+  // v = (2 * t1[0]) * (2 * t1[5])
+  EXPECT_DOUBLE_EQ(v->data, 2.0 * 6.0 * 2.0);
+  EXPECT_DOUBLE_EQ(t1->grad[0], 2.0 * 2.0 * 6.0);
+  EXPECT_DOUBLE_EQ(t1->grad[5], 2.0 * 2.0 * 1.0);
+  EXPECT_DOUBLE_EQ(t1->grad[1], 0.0);
+}
+
+TEST(TensorTest, DeepChainBackward) {
+  // the topological sort is iterative, so long chains don't overflow the stack
+  const int n = 200000;
+  std::shared_ptr<Tensor> x = std::make_shared<Tensor>(std::vector<int>{2});
+  x->data = {1.0, 2.0};
+  x->requires_grad = true;
+  std::shared_ptr<Tensor> out = x;
+  for (int i = 0; i < n; i++) {
+    out = out->add(x);
+  }
+  out->backward();
+  EXPECT_DOUBLE_EQ(out->data[1], 2.0 * (n + 1));
+  EXPECT_DOUBLE_EQ(x->grad[0], double(n + 1));
+  EXPECT_DOUBLE_EQ(x->grad[1], double(n + 1));
+
+  // a second pass gets a new epoch, so every tensor is visited again
+  out->backward();
+  EXPECT_DOUBLE_EQ(x->grad[0], 2.0 * (n + 1));
+
+  // dropping the chain frees it in a loop, not n nested destructors
+  out.reset();
+  EXPECT_EQ(x.use_count(), 1);
+}
+
+TEST(TensorTest, BackwardWithoutRetainingTheGraph) {
+  auto build = [](std::shared_ptr<Tensor> x) {
+    return x->tanh()->matmul(x->relu())->add(x)->sigmoid();
+  };
+  std::shared_ptr<Tensor> x = std::make_shared<Tensor>(std::vector<int>{2, 2});
+  x->data = {0.5, -1.0, 2.0, 0.25};
+  x->requires_grad = true;
+  std::shared_ptr<Tensor> x_copy = std::make_shared<Tensor>(x->shape);
+  x_copy->data = x->data;
+  x_copy->requires_grad = true;
+
+  // reference: the usual, retained pass
+  build(x_copy)->backward();
+
+  std::shared_ptr<Tensor> out = build(x);
+  // tanh(x), only held by the graph
+  std::weak_ptr<Tensor> hidden = out->_prev[0]->_prev[0]->_prev[0];
+  ASSERT_EQ(hidden.lock()->_op, 't');
+  out->backward(false);
+
+  EXPECT_TRUE(hidden.expired());
+  EXPECT_TRUE(out->_prev.empty());
+  EXPECT_FALSE(out->grad.empty()); // roots keep their grad
+  for (size_t i = 0; i < x->data.size(); i++) {
+    EXPECT_DOUBLE_EQ(x->grad[i], x_copy->grad[i]);
+  }
+}
+
+TEST(TensorTest, ParallelBackwardMatchesSerial) {
+  // independent branches that all read `x` (two of them divide by the same
+  // scalar `d`), joined at the end
+  auto build = [](std::shared_ptr<Tensor> x, std::shared_ptr<Value> d) {
+    std::shared_ptr<Tensor> a = x->tanh()->matmul(x->relu());
+    std::shared_ptr<Tensor> b = x->sigmoid()->matmul(x->gelu());
+    std::shared_ptr<Tensor> c = x->leakyRelu(0.1)->add(x->softmax());
+    std::shared_ptr<Tensor> e = x->relu()->div(d)->add(x->tanh()->div(d));
+    return a->add(b)->add(c)->add(e)->tanh();
+  };
+  auto make_input = []() {
+    std::shared_ptr<Tensor> x =
+        std::make_shared<Tensor>(std::vector<int>{3, 3});
+    x->data = {0.5, -1.0, 2.0, 0.25, -0.75, 1.5, -2.0, 0.1, 0.9};
+    x->requires_grad = true;
+    return x;
+  };
+  size_t threads = ThreadPool::global().size();
+
+  ThreadPool::set_global_threads(1);
+  std::shared_ptr<Tensor> serial = make_input();
+  auto serial_d = std::make_shared<Value>(2.0);
+  build(serial, serial_d)->backward();
+
+  ThreadPool::set_global_threads(4);
+  std::shared_ptr<Tensor> retained = make_input();
+  auto retained_d = std::make_shared<Value>(2.0);
+  build(retained, retained_d)->backward();
+  std::shared_ptr<Tensor> consumed = make_input();
+  auto consumed_d = std::make_shared<Value>(2.0);
+  std::shared_ptr<Tensor> out = build(consumed, consumed_d);
+  out->backward(false);
+  EXPECT_TRUE(out->_prev.empty());
+  ThreadPool::set_global_threads(threads);
+
+  for (size_t i = 0; i < serial->data.size(); i++) {
+    EXPECT_NEAR(retained->grad[i], serial->grad[i], 1e-12);
+    EXPECT_NEAR(consumed->grad[i], serial->grad[i], 1e-12);
+  }
+  EXPECT_NEAR(retained_d->grad, serial_d->grad, 1e-12);
+  EXPECT_NEAR(consumed_d->grad, serial_d->grad, 1e-12);
+}
+
+TEST(TensorTest, LazyFusionMatchesEager) {
+  // big enough to be split between threads
+  set_num_threads(4);
+  auto make = [](std::vector<int> shape, double scale) {
+    std::shared_ptr<Tensor> t = std::make_shared<Tensor>(shape);
+    for (size_t i = 0; i < t->data.size(); i++) {
+      t->data[i] = std::sin(scale * double(i));
+    }
+    t->requires_grad = true;
+    return t;
+  };
+  std::shared_ptr<Tensor> x = make({4, 5000}, 0.01);
+  std::shared_ptr<Tensor> bias = make({5000}, 0.3);
+  std::shared_ptr<Tensor> gate = make({4, 5000}, 0.07);
+  std::shared_ptr<Tensor> x2 = make({4, 5000}, 0.01);
+  std::shared_ptr<Tensor> bias2 = make({5000}, 0.3);
+  std::shared_ptr<Tensor> gate2 = make({4, 5000}, 0.07);
+
+  std::shared_ptr<LazyTensor> chain = x->lazy()
+                                          ->add(bias)
+                                          ->tanh()
+                                          ->mul(gate)
+                                          ->gelu()
+                                          ->leakyRelu(0.1)
+                                          ->sigmoid()
+                                          ->relu();
+  EXPECT_EQ(chain->size(), 7);
+  std::shared_ptr<Tensor> fused = chain->materialize();
+  EXPECT_EQ(chain->size(), 0);
+  EXPECT_EQ(fused->_op, 'F');
+  EXPECT_EQ(fused->_prev.size(), 3); // x, bias and gate
+
+  std::shared_ptr<Tensor> eager = x2->add(bias2)
+                                      ->tanh()
+                                      ->mul(gate2)
+                                      ->gelu()
+                                      ->leakyRelu(0.1)
+                                      ->sigmoid()
+                                      ->relu();
+  // weigh the elements, so every grad is different
+  std::shared_ptr<Tensor> w = make({4, 5000}, 0.5);
+  w->requires_grad = false;
+  fused->mul(w)->backward();
+  eager->mul(w)->backward();
+
+  for (size_t i = 0; i < x->data.size(); i++) {
+    ASSERT_NEAR(fused->data[i], eager->data[i], 1e-12);
+    ASSERT_NEAR(x->grad[i], x2->grad[i], 1e-12);
+    ASSERT_NEAR(gate->grad[i], gate2->grad[i], 1e-12);
+  }
+  for (size_t i = 0; i < bias->data.size(); i++) {
+    ASSERT_NEAR(bias->grad[i], bias2->grad[i], 1e-10);
+  }
+
+  // a (4, 1) operand isn't a trailing broadcast: the chain so far runs, and
+  // the add is an eager one
+  std::shared_ptr<Tensor> col = make({4, 1}, 1.0);
+  chain = x->lazy()->relu()->add(col);
+  EXPECT_EQ(chain->size(), 0);
+  std::shared_ptr<Tensor> out = chain->tanh()->materialize();
+  EXPECT_EQ(out->_prev[0]->_op, '+');
+  EXPECT_DOUBLE_EQ(
+      out->data[5001], std::tanh(std::max(x->data[5001], 0.0) + col->data[1]));
+
+  // two chains branching off the same one each keep their own ops
+  std::shared_ptr<LazyTensor> a = x->lazy()->relu();
+  std::shared_ptr<LazyTensor> b = a->tanh();
+  std::shared_ptr<LazyTensor> c = a->sigmoid();
+  EXPECT_NE(b, c);
+  EXPECT_EQ(a->size(), 1);
+  EXPECT_EQ(b->size(), 2);
+  EXPECT_EQ(c->size(), 2);
+  std::shared_ptr<Tensor> tb = b->materialize();
+  std::shared_ptr<Tensor> tc = c->materialize();
+  std::shared_ptr<Tensor> ta = a->materialize();
+  EXPECT_DOUBLE_EQ(ta->data[7], std::max(x->data[7], 0.0));
+  EXPECT_DOUBLE_EQ(tb->data[7], std::tanh(ta->data[7]));
+  EXPECT_DOUBLE_EQ(tc->data[7], 1.0 / (1.0 + std::exp(-ta->data[7])));
+
+  // no ops: the tensor itself
+  EXPECT_EQ(x->lazy()->materialize(), x);
+  set_num_threads(0);
+}
+
+TEST_F(TensorFixtureTest, RequiresGradPrunesBackward) {
+  // inputs don't require grad by default, so ops on them build no graph
+  std::shared_ptr<Tensor> constant = t1->relu();
+  EXPECT_FALSE(constant->requires_grad);
+  EXPECT_TRUE(constant->_prev.empty());
+  EXPECT_TRUE(constant->is_leaf());
+
+  // only the tensors that require grad get one
+  t2->requires_grad = true;
+  std::shared_ptr<Tensor> out = constant->matmul(t2)->relu();
+  EXPECT_TRUE(out->requires_grad);
+  out->backward();
+
+  EXPECT_TRUE(t1->grad.empty());
+  EXPECT_TRUE(constant->grad.empty());
+  ASSERT_EQ(t2->grad.size(), 6);
+  EXPECT_DOUBLE_EQ(t2->grad[0], 1.0 + 4.0);
+}
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "thread_pool.h"
+
+// spin until `counter` reaches `expected` (the pool has no wait)
+static void wait_for(std::atomic<int>& counter, int expected) {
+  while (counter < expected) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+TEST(ThreadPoolTest, RunsEveryTask) {
+  ThreadPool pool(4);
+  EXPECT_EQ(pool.size(), 4);
+  EXPECT_FALSE(ThreadPool::on_worker());
+
+  std::atomic<int> done{0};
+  for (int i = 0; i < 1000; i++) {
+    pool.submit([&done]() { done++; });
+  }
+  wait_for(done, 1000);
+  EXPECT_EQ(done, 1000);
+}
+
+TEST(ThreadPoolTest, TasksSubmittedFromAWorker) {
+  ThreadPool pool(3);
+  std::atomic<int> done{0};
+  std::atomic<int> on_worker{0};
+
+  // every task lands on the deque of the worker running the parent, the
+  // idle workers have to steal them
+  for (int i = 0; i < 4; i++) {
+    pool.submit([&]() {
+      for (int j = 0; j < 50; j++) {
+        pool.submit([&]() {
+          on_worker += ThreadPool::on_worker() ? 1 : 0;
+          done++;
+        });
+      }
+    });
+  }
+  wait_for(done, 200);
+  EXPECT_EQ(done, 200);
+  EXPECT_EQ(on_worker, 200);
+}
+
+TEST(ThreadPoolTest, ParallelForCoversTheRangeOnce) {
+  set_num_threads(4);
+  EXPECT_EQ(get_num_threads(), 4);
+
+  std::vector<std::atomic<int>> hits(10007);
+  parallel_for(3, hits.size(), 100, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      hits[i]++;
+    }
+  });
+  for (size_t i = 0; i < hits.size(); i++) {
+    ASSERT_EQ(hits[i], i < 3 ? 0 : 1) << i;
+  }
+
+  // nested, from the pool's own workers
+  std::atomic<int> total{0};
+  parallel_for(0, 8, 1, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      parallel_for(0, 1000, 10, [&](size_t l, size_t h) {
+        total += int(h - l);
+      });
+    }
+  });
+  EXPECT_EQ(total, 8000);
+
+  EXPECT_THROW(
+      parallel_for(
+          0,
+          1000,
+          1,
+          [](size_t lo, size_t) {
+            if (lo == 0) {
+              throw std::runtime_error("chunk failed");
+            }
+          }),
+      std::runtime_error);
+  EXPECT_THROW(set_num_threads(-1), std::invalid_argument);
+
+  set_num_threads(0);
+}
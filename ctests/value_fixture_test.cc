@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
+#include <cmath>
 #include <memory>
+#include <stdexcept>
+#include <vector>
+#include "grad_mode.h"
+#include "tape.h"
 #include "value.h"
 
 // `Value fixture` for googletest
@@ -156,3 +161,186 @@ TEST_F(ValueTest, CombinedTest) {
   EXPECT_DOUBLE_EQ(y->grad, double(5 * 1.0));
   EXPECT_DOUBLE_EQ(z->grad, double(1.0));
 }
+
+TEST_F(ValueTest, SharedSubExpression) {
+  // z = (x * y) + (x * y)^2, with `x * y` used twice
+  std::shared_ptr<Value> x = std::make_shared<Value>(3.0);
+  std::shared_ptr<Value> y = std::make_shared<Value>(2.0);
+  std::shared_ptr<Value> xy = x->mul(y);
+  std::shared_ptr<Value> z = xy->add(xy->pow(2));
+
+  z->backward();
+
+  // dz/dxy = 1 + 2 * xy = 13
+  EXPECT_DOUBLE_EQ(xy->grad, 13.0);
+  EXPECT_DOUBLE_EQ(x->grad, 13.0 * 2.0);
+  EXPECT_DOUBLE_EQ(y->grad, 13.0 * 3.0);
+}
+
+TEST_F(ValueTest, TapeRecordsAreConsumed) {
+  size_t tape_size = Tape::current().size();
+
+  std::shared_ptr<Value> z = v1->mul(v2)->neg();
+  EXPECT_EQ(Tape::current().size(), tape_size + 2);
+
+  z->backward();
+  EXPECT_DOUBLE_EQ(v1->grad, -4.2);
+  EXPECT_DOUBLE_EQ(v2->grad, -5.1);
+  EXPECT_EQ(Tape::current().size(), tape_size);
+
+  // the graph was consumed, so a second backward doesn't double count
+  z->backward();
+  EXPECT_DOUBLE_EQ(v1->grad, -4.2);
+}
+
+TEST_F(ValueTest, BackwardPastADroppedNode) {
+  size_t tape_size = Tape::current().size();
+  std::shared_ptr<Value> a = std::make_shared<Value>(3.0);
+  std::shared_ptr<Value> t1 = a->mul(a);
+  std::shared_ptr<Value> tmp = a->add(a);
+  std::shared_ptr<Value> y = t1->mul(a);
+  // a dead slot between the root and the rest of the graph: releasing the
+  // root's slot during the walk must not shrink the tape under it
+  tmp.reset();
+
+  y->backward();
+  EXPECT_DOUBLE_EQ(a->grad, 27.0); // d(a^3)/da
+  EXPECT_DOUBLE_EQ(t1->grad, 3.0);
+  t1.reset();
+  y.reset();
+  EXPECT_EQ(Tape::current().size(), tape_size);
+}
+
+TEST_F(ValueTest, TapeShrinksWhenGraphIsDropped) {
+  size_t tape_size = Tape::current().size();
+  {
+    std::shared_ptr<Value> z = v1;
+    for (int i = 0; i < 2000; i++) {
+      z = z->add(v2)->tanh();
+    }
+    EXPECT_EQ(Tape::current().size(), tape_size + 4000);
+  }
+  EXPECT_EQ(Tape::current().size(), tape_size);
+}
+
+TEST_F(ValueTest, DroppingALongChainDoesntRecurse) {
+  size_t tape_size = Tape::current().size();
+  {
+    // forward only, never backpropagated
+    std::shared_ptr<Value> z = v1;
+    for (int i = 0; i < 1000000; i++) {
+      z = z->add(v2);
+    }
+  }
+  EXPECT_EQ(Tape::current().size(), tape_size);
+  EXPECT_EQ(v1.use_count(), 1);
+  EXPECT_EQ(v2.use_count(), 1);
+}
+
+TEST(ValueNoGrad, NoGraphIsRecorded) {
+  std::shared_ptr<Value> a = std::make_shared<Value>(3.0);
+  std::shared_ptr<Value> b = std::make_shared<Value>(4.0);
+  size_t tape_size = Tape::current().size();
+
+  std::shared_ptr<Value> c;
+  {
+    NoGradGuard no_grad;
+    EXPECT_FALSE(GradMode::is_enabled());
+    c = a->mul(b)->add(1.0)->tanh();
+    {
+      NoGradGuard nested;
+    }
+    EXPECT_FALSE(GradMode::is_enabled()); // restores the outer mode
+  }
+  EXPECT_TRUE(GradMode::is_enabled());
+
+  EXPECT_DOUBLE_EQ(c->data, std::tanh(13.0));
+  EXPECT_TRUE(c->prev().empty());
+  EXPECT_EQ(c->_tape_idx, -1);
+  EXPECT_EQ(Tape::current().size(), tape_size);
+
+  c->backward();
+  EXPECT_DOUBLE_EQ(a->grad, 0.0);
+}
+
+TEST(ValueReduction, SumAndDotAreSingleNodes) {
+  std::vector<std::shared_ptr<Value>> a;
+  std::vector<std::shared_ptr<Value>> b;
+  for (int i = 0; i < 4; i++) {
+    a.push_back(std::make_shared<Value>(i + 1.0)); // 1 2 3 4
+    b.push_back(std::make_shared<Value>(0.5 * i)); // 0 .5 1 1.5
+  }
+  size_t tape_size = Tape::current().size();
+
+  std::shared_ptr<Value> d = Value::dot(a, b);
+  std::shared_ptr<Value> s = Value::sum(a);
+  std::shared_ptr<Value> out = d->mul(s);
+  EXPECT_EQ(Tape::current().size(), tape_size + 3);
+  EXPECT_DOUBLE_EQ(d->data, 0.0 + 1.0 + 3.0 + 6.0);
+  EXPECT_DOUBLE_EQ(s->data, 10.0);
+
+  // out = dot(a, b) * sum(a)
+  out->backward();
+  for (int i = 0; i < 4; i++) {
+    EXPECT_DOUBLE_EQ(a[i]->grad, b[i]->data * 10.0 + 10.0);
+    EXPECT_DOUBLE_EQ(b[i]->grad, a[i]->data * 10.0);
+  }
+
+  EXPECT_THROW(Value::dot(a, {b[0]}), std::runtime_error);
+}
+
+TEST(ValueReduction, DotWithItselfAndWideSum) {
+  std::shared_ptr<Value> x = std::make_shared<Value>(3.0);
+  std::shared_ptr<Value> sq = Value::dot({x}, {x});
+  sq->backward();
+  EXPECT_DOUBLE_EQ(sq->data, 9.0);
+  EXPECT_DOUBLE_EQ(x->grad, 6.0);
+
+  // one node no matter how many inputs, so no deep chain to walk or free
+  std::vector<std::shared_ptr<Value>> values;
+  for (int i = 0; i < 100000; i++) {
+    values.push_back(std::make_shared<Value>(1.0));
+  }
+  std::shared_ptr<Value> total = Value::sum(values)->tanh();
+  total->backward();
+  EXPECT_EQ(total->prev().size(), 0); // consumed
+  EXPECT_DOUBLE_EQ(values[12345]->grad, 1.0 - total->data * total->data);
+}
+
+TEST(ValueRequiresGrad, ConstantsAreNotRecorded) {
+  std::shared_ptr<Value> x = std::make_shared<Value>(2.0);
+  std::shared_ptr<Value> c = std::make_shared<Value>(3.0);
+  c->requires_grad = false;
+  size_t tape_size = Tape::current().size();
+
+  std::shared_ptr<Value> c2 = c->mul(c)->add(1.0);
+  EXPECT_FALSE(c2->requires_grad);
+  EXPECT_EQ(Tape::current().size(), tape_size);
+
+  std::shared_ptr<Value> out = x->mul(c2);
+  EXPECT_TRUE(out->requires_grad);
+  out->backward();
+  EXPECT_DOUBLE_EQ(x->grad, 10.0);
+  EXPECT_DOUBLE_EQ(c->grad, 0.0);
+  EXPECT_DOUBLE_EQ(c2->grad, 0.0);
+}
+
+TEST(ValueLayout, NodesAreCompact) {
+  // op, saved operand and up to two inputs are inline, the tape only holds
+  // a pointer per node
+  EXPECT_LE(sizeof(Value), 96);
+
+  std::shared_ptr<Value> x = std::make_shared<Value>(2.0);
+  std::shared_ptr<Value> y = x->leakyRelu(0.1)->pow(3);
+  EXPECT_EQ(y->op, Op::Pow);
+  EXPECT_DOUBLE_EQ(y->saved, 3.0);
+  ASSERT_EQ(y->num_inputs(), 1);
+  EXPECT_EQ(y->input(0)->op, Op::LeakyRelu);
+  EXPECT_DOUBLE_EQ(y->input(0)->saved, 0.1);
+
+  // more than two inputs go out of line
+  std::vector<std::shared_ptr<Value>> values = {x, x, y};
+  std::shared_ptr<Value> s = Value::sum(values);
+  EXPECT_EQ(s->num_inputs(), 3);
+  EXPECT_EQ(s->prev()[2], y);
+}
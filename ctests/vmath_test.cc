@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include "vmath.h"
+
+// largest relative error of y against ref(x), over nonzero ref
+template <class Ref>
+static double max_rel_error(
+    const std::vector<double>& x,
+    const std::vector<double>& y,
+    Ref ref) {
+  double worst = 0.0;
+  for (size_t i = 0; i < x.size(); i++) {
+    double r = ref(x[i]);
+    if (r != 0.0) {
+      worst = std::max(worst, std::fabs(y[i] - r) / std::fabs(r));
+    }
+  }
+  return worst;
+}
+
+// n points evenly over [lo, hi]
+static std::vector<double> range(double lo, double hi, size_t n) {
+  std::vector<double> x(n);
+  for (size_t i = 0; i < n; i++) {
+    x[i] = lo + (hi - lo) * double(i) / double(n - 1);
+  }
+  return x;
+}
+
+TEST(VmathTest, MatchesLibmForEveryKernel) {
+  std::string original = vmath_kernel();
+  for (std::string kernel : {"generic", "avx2", "avx512"}) {
+    if (!set_vmath_kernel(kernel)) {
+      continue; // not supported on this CPU
+    }
+    EXPECT_EQ(vmath_kernel(), kernel);
+
+    // odd size: the tail goes through the padded path
+    std::vector<double> x = range(-708.0, 709.7, 100003);
+    std::vector<double> y(x.size());
+    vexp(x.data(), y.data(), x.size());
+    EXPECT_LT(max_rel_error(x, y, [](double v) { return std::exp(v); }), 4e-16)
+        << kernel;
+
+    x = range(-20.0, 20.0, 100003);
+    vtanh(x.data(), y.data(), x.size());
+    EXPECT_LT(max_rel_error(x, y, [](double v) { return std::tanh(v); }), 6e-16)
+        << kernel;
+
+    x = range(-700.0, 40.0, 100003);
+    vsigmoid(x.data(), y.data(), x.size());
+    auto sigmoid = [](double v) { return 1.0 / (1.0 + std::exp(-v)); };
+    EXPECT_LT(max_rel_error(x, y, sigmoid), 8e-16) << kernel;
+
+    // gelu and its grad, the tanh saved by forward used by backward
+    double scale = std::sqrt(2.0 / M_PI);
+    x = range(-5.0, 5.0, 1001);
+    std::vector<double> t(x.size());
+    vgelu(x.data(), y.data(), t.data(), x.size());
+    std::vector<double> dy(x.size(), 2.0), dx(x.size(), 1.0);
+    gelu_backward(x.data(), t.data(), dy.data(), dx.data(), x.size());
+    for (size_t i = 0; i < x.size(); i++) {
+      double u = std::tanh(scale * (x[i] + 0.044715 * std::pow(x[i], 3)));
+      EXPECT_NEAR(y[i], 0.5 * x[i] * (1.0 + u), 1e-14);
+      EXPECT_NEAR(t[i], u, 1e-15);
+      double factor = 0.5 * (1.0 + u) +
+          0.5 * x[i] * (1.0 - u * u) * scale *
+              (1.0 + 3 * 0.044715 * x[i] * x[i]);
+      EXPECT_NEAR(dx[i], 1.0 + 2.0 * factor, 1e-14);
+    }
+
+    // special values
+    double inf = std::numeric_limits<double>::infinity();
+    std::vector<double> special = {inf, -inf, NAN, 710.0, -710.0, 0.0, 1e-300};
+    std::vector<double> out(special.size());
+    vexp(special.data(), out.data(), special.size());
+    EXPECT_EQ(out[0], inf);
+    EXPECT_EQ(out[1], 0.0);
+    EXPECT_TRUE(std::isnan(out[2]));
+    EXPECT_EQ(out[3], inf);
+    EXPECT_EQ(out[4], 0.0);
+    EXPECT_EQ(out[5], 1.0);
+    EXPECT_EQ(out[6], 1.0);
+
+    vtanh(special.data(), out.data(), special.size());
+    EXPECT_EQ(out[0], 1.0);
+    EXPECT_EQ(out[1], -1.0);
+    EXPECT_TRUE(std::isnan(out[2]));
+    EXPECT_EQ(out[3], 1.0);
+    EXPECT_EQ(out[4], -1.0);
+    EXPECT_EQ(out[5], 0.0);
+    EXPECT_EQ(out[6], 1e-300);
+
+    vsigmoid(special.data(), out.data(), special.size());
+    EXPECT_EQ(out[0], 1.0);
+    EXPECT_EQ(out[1], 0.0);
+    EXPECT_TRUE(std::isnan(out[2]));
+    EXPECT_EQ(out[5], 0.5);
+  }
+  EXPECT_TRUE(set_vmath_kernel(original));
+  EXPECT_FALSE(set_vmath_kernel("sse9"));
+}
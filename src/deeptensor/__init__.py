@@ -5,9 +5,11 @@ from ._core import (  # type: ignore  # noqa: PGH003
     SGD,
     AdaGrad,
     Adam,
+    CapturedStep,
     Conv2D,
     Flatten,
     GeLu,
+    LazyTensor,
     LeakyReLu,
     LinearLayer,
     MaxPooling2D,
@@ -22,18 +24,28 @@ from ._core import (  # type: ignore  # noqa: PGH003
     Value,
     __doc__,
     binary_cross_entropy,
+    buffer_cache_stats,
     cross_entropy,
+    empty_buffer_cache,
+    get_num_threads,
+    is_grad_enabled,
     mean_squared_error,
+    no_grad,
+    set_buffer_cache_limit,
+    set_grad_enabled,
+    set_num_threads,
 )
 
 __all__ = [
     "SGD",
     "AdaGrad",
     "Adam",
+    "CapturedStep",
     "Conv2D",
     "LinearLayer",
     "Flatten",
     "GeLu",
+    "LazyTensor",
     "LeakyReLu",
     "MaxPooling2D",
     "Model",
@@ -47,7 +59,15 @@ __all__ = [
     "Value",
     "__doc__",
     "binary_cross_entropy",
+    "buffer_cache_stats",
     "cross_entropy",
+    "empty_buffer_cache",
+    "get_num_threads",
+    "is_grad_enabled",
     "mean_squared_error",
+    "no_grad",
+    "set_buffer_cache_limit",
+    "set_grad_enabled",
+    "set_num_threads",
     "version",
 ]
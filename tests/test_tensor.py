@@ -1,6 +1,8 @@
 from __future__ import annotations
 
-from math import isclose
+from math import exp, isclose, log
+
+import pytest
 
 from deeptensor import Tensor, Value
 
@@ -95,3 +97,79 @@ def test_matmul():
             assert (
                 t3.get([i, j]).data == expected_val[i][j]
             ), f"Matrix multiplication failed: {t3} != {expected}"
+
+
+def test_lazy_fusion():
+    x = Tensor([2, 3])
+    bias = Tensor([3])
+    for i in range(6):
+        x.set(i, Value(i - 2.5))
+    for i in range(3):
+        bias.set(i, Value(0.5 * i))
+
+    chain = x.lazy().add(bias).relu().tanh()
+    assert len(chain) == 3
+    fused = chain.materialize()
+    eager = (x + bias).relu().tanh()
+    for i in range(6):
+        assert isclose(fused.get(i).data, eager.get(i).data)
+
+
+def test_reductions():
+    x = Tensor([2, 3])
+    for i in range(6):
+        x.set(i, Value(i + 1))
+
+    assert x.sum().get(0).data == 21
+    cols = x.sum([0])
+    assert [cols.get(i).data for i in range(3)] == [5, 7, 9]
+    assert x.mean([1], keepdim=True).shape == [2, 1]
+    assert x.max([1]).get(1).data == 6
+    assert x.argmax([1]).get(0).data == 2
+    assert isclose(x.var([1]).get(0).data, 1.0)
+
+
+def test_softmax_along_dim():
+    x = Tensor([2, 3])
+    for i in range(6):
+        x.set(i, Value(i + 1))
+
+    rows = x.softmax(1).sum([1])
+    assert isclose(rows.get(0).data, 1.0)
+    assert isclose(rows.get(1).data, 1.0)
+    log_p = x.log_softmax(0)
+    assert isclose(log_p.get(0).data, -log(1 + exp(3)))
+
+
+def test_numpy_shares_memory():
+    np = pytest.importorskip("numpy")
+    arr = np.arange(6, dtype=np.float64).reshape(2, 3)
+    x = Tensor.from_numpy(arr)
+    assert x.shape == [2, 3]
+    arr[0, 1] = 10.0  # not copied: writes show through
+    assert x.get([0, 1]).data == 10.0
+
+    out = x.numpy()
+    out[1, 2] = 50.0
+    assert arr[1, 2] == 50.0
+    assert np.shares_memory(x.numpy(), arr)
+
+    # transposed: a view with strides, still shared
+    xt = Tensor.from_numpy(arr.T)
+    assert not xt.is_contiguous()
+    assert xt.get([1, 0]).data == 10.0
+
+    # int arrays are copied to float64
+    y = Tensor.from_numpy(np.ones((2, 2), dtype=np.int32))
+    assert y.get(3).data == 1.0
+
+    w = Tensor.from_numpy(np.ones((3,)))
+    w.requires_grad = True
+    assert w.grad is None
+    w.sum().backward()
+    g = w.grad
+    assert np.array_equal(g, np.ones(3))
+    w.sum().backward()  # accumulated in place: the array sees it
+    assert g[0] == 2.0
+    del w  # the array keeps the gradient alive
+    assert np.array_equal(g, np.full(3, 2.0))
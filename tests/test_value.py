@@ -2,7 +2,7 @@ from __future__ import annotations
 
 from math import isclose
 
-from deeptensor import Value
+from deeptensor import Value, is_grad_enabled, no_grad
 
 
 def test_value_usage():
@@ -29,3 +29,32 @@ def test_value_advanced_usage():
     assert isclose(c.grad, 1)
     assert isclose(a.grad, 10)  # 2*a*c_grad
     assert isclose(b.grad, 5)  # 5*c_grad
+
+
+def test_no_grad():
+    a = Value(5.0)
+    b = Value(4.0)
+
+    with no_grad():
+        assert not is_grad_enabled()
+        c = a * b + 1
+        assert isclose(c.data, 21)
+        assert len(c._prev) == 0  # no graph is recorded
+
+    assert is_grad_enabled()
+    c.backward()
+    assert a.grad == 0
+
+
+def test_sum_and_dot():
+    a = [Value(1.0), Value(2.0), Value(3.0)]
+    b = [Value(4.0), Value(5.0), Value(6.0)]
+
+    d = Value.dot(a, b)
+    assert isclose(d.data, 32)
+    assert len(d._prev) == 6  # one node for the whole product
+
+    out = d + Value.sum(a)
+    out.backward()
+    assert isclose(a[0].grad, 5)  # b[0] + 1
+    assert isclose(b[2].grad, 3)  # a[2]